@@ -0,0 +1,221 @@
+#include "bcsr.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int bc, lr, col;
+    double v;
+} block_entry;
+
+static int compare_block_entry(const void *a, const void *b) {
+    const block_entry *ea = a, *eb = b;
+    if (ea->bc != eb->bc)
+        return ea->bc - eb->bc;
+    if (ea->lr != eb->lr)
+        return ea->lr - eb->lr;
+    return ea->col - eb->col;
+}
+
+static int max_column(CSR g, int s, int t) {
+    int m = 0;
+#pragma omp parallel for schedule(static) reduction(max : m)
+    for (int i = g.row_ptr[s]; i < g.row_ptr[t]; i++)
+        if (g.col_idx[i] > m)
+            m = g.col_idx[i];
+    return m;
+}
+
+// Collects the entries of block row br sorted by block column, returns the number of blocks
+static int gather_block_row(CSR g, int s, int t, int r, int c, int br, block_entry **buffer, int *cap, int *n) {
+    int rs = s + br * r, rt = rs + r < t ? rs + r : t;
+    *n = g.row_ptr[rt] - g.row_ptr[rs];
+    if (*n > *cap) {
+        *cap = *n;
+        *buffer = realloc(*buffer, sizeof(block_entry) * (*cap));
+    }
+
+    int k = 0;
+    for (int u = rs; u < rt; u++) {
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            (*buffer)[k].bc = g.col_idx[i] / c;
+            (*buffer)[k].lr = u - rs;
+            (*buffer)[k].col = g.col_idx[i];
+            (*buffer)[k].v = g.values != NULL ? g.values[i] : 0.0;
+            k++;
+        }
+    }
+    qsort(*buffer, k, sizeof(block_entry), compare_block_entry);
+
+    int blocks = 0;
+    for (int i = 0; i < k; i++)
+        if (i == 0 || (*buffer)[i].bc != (*buffer)[i - 1].bc)
+            blocks++;
+    return blocks;
+}
+
+static long long count_blocks(CSR g, int s, int t, int r, int c) {
+    int num_block_rows = (t - s + r - 1) / r;
+    long long blocks = 0;
+
+#pragma omp parallel reduction(+ : blocks)
+    {
+        block_entry *buffer = NULL;
+        int cap = 0, n;
+#pragma omp for schedule(dynamic, 64)
+        for (int br = 0; br < num_block_rows; br++)
+            blocks += gather_block_row(g, s, t, r, c, br, &buffer, &cap, &n);
+        free(buffer);
+    }
+
+    return blocks;
+}
+
+double bcsr_fill_ratio(CSR g, int s, int t, int r, int c) {
+    long long nnz = g.row_ptr[t] - g.row_ptr[s];
+    if (nnz == 0)
+        return 1.0;
+    return (double)(count_blocks(g, s, t, r, c) * r * c) / (double)nnz;
+}
+
+// Picks the square block size that minimises the bytes streamed per SpMV, which is what
+// bounds a memory-bound kernel. Fill from explicit zeros is paid for in that estimate.
+void bcsr_detect_block_size(CSR g, int s, int t, int *r, int *c) {
+    static const int candidates[] = {1, 2, 3, 4, 6};
+    long long nnz = g.row_ptr[t] - g.row_ptr[s];
+    double best = (double)nnz * 12.0 + (double)(t - s + 1) * 4.0;
+    *r = 1;
+    *c = 1;
+
+    printf("Block 1x1: fill = 1.000, bytes = %.0f\n", best);
+    for (int k = 1; k < (int)(sizeof(candidates) / sizeof(candidates[0])); k++) {
+        int b = candidates[k];
+        long long blocks = count_blocks(g, s, t, b, b);
+        double bytes = (double)blocks * (8.0 * b * b + 4.0) + (double)((t - s + b - 1) / b + 1) * 4.0;
+        double fill = nnz > 0 ? (double)(blocks * b * b) / (double)nnz : 1.0;
+        printf("Block %dx%d: fill = %.3f, bytes = %.0f\n", b, b, fill, bytes);
+        if (bytes < best) {
+            best = bytes;
+            *r = b;
+            *c = b;
+        }
+    }
+    fflush(stdout);
+}
+
+BCSR build_bcsr(CSR g, int s, int t, int r, int c) {
+    BCSR m;
+    m.r = r;
+    m.c = c;
+    m.num_rows = t - s;
+    m.num_block_rows = (m.num_rows + r - 1) / r;
+    m.block_ptr = malloc(sizeof(int) * (m.num_block_rows + 1));
+
+    // The last block column is shifted left so that a block never reads past the end of x
+    int num_cols = max_column(g, s, t) + 1;
+    int last_start = num_cols - c > 0 ? num_cols - c : 0;
+
+    m.block_ptr[0] = 0;
+#pragma omp parallel
+    {
+        block_entry *buffer = NULL;
+        int cap = 0, n;
+#pragma omp for schedule(dynamic, 64)
+        for (int br = 0; br < m.num_block_rows; br++)
+            m.block_ptr[br + 1] = gather_block_row(g, s, t, r, c, br, &buffer, &cap, &n);
+        free(buffer);
+    }
+
+    for (int br = 0; br < m.num_block_rows; br++)
+        m.block_ptr[br + 1] += m.block_ptr[br];
+    m.num_blocks = m.block_ptr[m.num_block_rows];
+
+    m.block_col = malloc(sizeof(int) * (m.num_blocks + 1));
+    m.values = malloc(sizeof(double) * ((size_t)m.num_blocks * r * c + 1));
+
+#pragma omp parallel
+    {
+        block_entry *buffer = NULL;
+        int cap = 0, n;
+#pragma omp for schedule(dynamic, 64)
+        for (int br = 0; br < m.num_block_rows; br++) {
+            gather_block_row(g, s, t, r, c, br, &buffer, &cap, &n);
+
+            int b = m.block_ptr[br] - 1;
+            for (int i = 0; i < n; i++) {
+                if (i == 0 || buffer[i].bc != buffer[i - 1].bc) {
+                    b++;
+                    int start = buffer[i].bc * c;
+                    m.block_col[b] = start < last_start ? start : last_start;
+                    memset(m.values + (size_t)b * r * c, 0, sizeof(double) * r * c);
+                }
+                m.values[(size_t)b * r * c + buffer[i].lr * c + (buffer[i].col - m.block_col[b])] += buffer[i].v;
+            }
+        }
+        free(buffer);
+    }
+
+    return m;
+}
+
+// One kernel per block size, the constant bounds let the compiler fully unroll the block
+#define BCSR_KERNEL(R, C)                                                                                              \
+    static void spmv_bcsr_##R##x##C(BCSR m, int s, double *x, double *y) {                                             \
+        _Pragma("omp parallel for schedule(static)") for (int br = 0; br < m.num_block_rows; br++) {                   \
+            double z[R] = {0.0};                                                                                       \
+            for (int b = m.block_ptr[br]; b < m.block_ptr[br + 1]; b++) {                                              \
+                const double *a = m.values + (size_t)b * (R * C);                                                      \
+                const double *xb = x + m.block_col[b];                                                                 \
+                for (int i = 0; i < R; i++)                                                                            \
+                    for (int j = 0; j < C; j++)                                                                        \
+                        z[i] += a[i * C + j] * xb[j];                                                                  \
+            }                                                                                                          \
+            for (int i = 0; i < R && br * R + i < m.num_rows; i++)                                                     \
+                y[s + br * R + i] = z[i];                                                                              \
+        }                                                                                                              \
+    }
+
+BCSR_KERNEL(2, 2)
+BCSR_KERNEL(3, 3)
+BCSR_KERNEL(4, 4)
+BCSR_KERNEL(6, 6)
+
+static void spmv_bcsr_generic(BCSR m, int s, double *x, double *y) {
+    int r = m.r, c = m.c;
+#pragma omp parallel for schedule(static)
+    for (int br = 0; br < m.num_block_rows; br++) {
+        for (int i = 0; i < r && br * r + i < m.num_rows; i++) {
+            double z = 0.0;
+            for (int b = m.block_ptr[br]; b < m.block_ptr[br + 1]; b++) {
+                const double *a = m.values + (size_t)b * r * c + i * c;
+                for (int j = 0; j < c; j++)
+                    z += a[j] * x[m.block_col[b] + j];
+            }
+            y[s + br * r + i] = z;
+        }
+    }
+}
+
+void spmv_bcsr(BCSR m, int s, double *x, double *y) {
+    if (m.r == 2 && m.c == 2)
+        spmv_bcsr_2x2(m, s, x, y);
+    else if (m.r == 3 && m.c == 3)
+        spmv_bcsr_3x3(m, s, x, y);
+    else if (m.r == 4 && m.c == 4)
+        spmv_bcsr_4x4(m, s, x, y);
+    else if (m.r == 6 && m.c == 6)
+        spmv_bcsr_6x6(m, s, x, y);
+    else
+        spmv_bcsr_generic(m, s, x, y);
+}
+
+void free_bcsr(BCSR *m) {
+    free(m->block_ptr);
+    free(m->block_col);
+    free(m->values);
+    m->block_ptr = NULL;
+    m->block_col = NULL;
+    m->values = NULL;
+    m->num_rows = 0;
+    m->num_block_rows = 0;
+    m->num_blocks = 0;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "mtx.h"
+
+// Register-blocked CSR with dense r x c blocks stored row-major. block_col holds the first
+// column of each block, so one index is loaded per block instead of per nonzero.
+typedef struct {
+    int r, c;
+    int num_rows, num_block_rows, num_blocks;
+    int *block_ptr, *block_col;
+    double *values;
+} BCSR;
+
+double bcsr_fill_ratio(CSR g, int s, int t, int r, int c);
+
+void bcsr_detect_block_size(CSR g, int s, int t, int *r, int *c);
+
+BCSR build_bcsr(CSR g, int s, int t, int r, int c);
+
+void spmv_bcsr(BCSR m, int s, double *x, double *y);
+
+void free_bcsr(BCSR *m);
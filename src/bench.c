@@ -0,0 +1,542 @@
+#include "bench.h"
+#include "local.h"
+#include "stream.h"
+#include <math.h>
+#include <mpi.h>
+#include <omp.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const strategy *strategies[] = {&strategy_sequential, &strategy_allgather, &strategy_separators,
+                                       &strategy_pairwise, &strategy_halo};
+
+static const strategy *find_strategy(const char *name) {
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++)
+        if (strcasecmp(name, strategies[i]->name) == 0 || strcasecmp(name, strategies[i]->alias) == 0)
+            return strategies[i];
+    return NULL;
+}
+
+void distribute_rows(bench_state *b, CSR g) {
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Bcast(b->p, b->size + 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    // Each rank keeps its own nonzeros only, rows and vectors keep the global numbering
+    CSR own = scatter_rows(g, b->p, b->rank, b->size);
+    if (b->rank == 0)
+        free_graph(&g);
+    b->g = own;
+    b->nnz = own.num_cols;
+    MPI_Allreduce(MPI_IN_PLACE, &b->nnz, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    b->n = own.num_rows;
+    b->s = b->p[b->rank];
+    b->t = b->p[b->rank + 1];
+}
+
+// Every run starts from the same vector, so its result does not depend on the runs before
+static void reset_vectors(bench_state *b) {
+    for (long i = 0; i < (long)b->n * b->opt.num_vectors; i++) {
+        b->x[i] = 2.0;
+        b->y[i] = 2.0;
+    }
+}
+
+// L2 norm of the owned rows of x over all ranks, valid on rank 0
+static double global_norm(bench_state *b) {
+    int nv = b->opt.num_vectors;
+    double l2 = 0.0, l2_local = 0.0;
+    for (long j = (long)b->s * nv; j < (long)b->t * nv; j++)
+        l2_local += b->x[j] * b->x[j];
+    MPI_Reduce(&l2_local, &l2, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    return sqrt(l2);
+}
+
+static const struct {
+    const char *name, *label;
+    size_t offset;
+} phases[NUM_PHASES] = {{"total", "Total", offsetof(phase_times, total)},
+                        {"spmv", "Local SpMV", offsetof(phase_times, spmv)},
+                        {"pack", "Pack", offsetof(phase_times, pack)},
+                        {"post", "Post", offsetof(phase_times, post)},
+                        {"wait", "Wait", offsetof(phase_times, wait)},
+                        {"unpack", "Unpack", offsetof(phase_times, unpack)},
+                        {"idle", "Barrier/idle", offsetof(phase_times, idle)},
+                        {"comm", "Communication", offsetof(phase_times, comm)},
+                        {"blocking", "Blocking exchange", offsetof(phase_times, blocking)}};
+
+static double phase_time(const phase_times *t, int phase) {
+    return *(const double *)((const char *)t + phases[phase].offset);
+}
+
+stamp take_stamp(const bench_state *b) {
+    stamp s = {MPI_Wtime()};
+    if (b->counters.threads > 0)
+        read_counters(&b->counters, &s.events);
+    return s;
+}
+
+void add_phase(phase_times *t, int phase, stamp from, stamp to) {
+    *(double *)((char *)t + phases[phase].offset) += to.time - from.time;
+    for (int e = 0; e < NUM_EVENTS; e++)
+        t->events[phase].count[e] += to.events.count[e] - from.events.count[e];
+}
+
+typedef struct {
+    double min, p10, median, p90, max;
+} summary;
+
+// Percentiles of one phase over the runs, interpolated between the closest two
+static summary summarize(const phase_times *runs, int n, int phase) {
+    double *v = malloc(sizeof(double) * n);
+    for (int i = 0; i < n; i++)
+        v[i] = phase_time(&runs[i], phase);
+    for (int i = 1; i < n; i++) {
+        double key = v[i];
+        int j = i - 1;
+        for (; j >= 0 && v[j] > key; j--)
+            v[j + 1] = v[j];
+        v[j + 1] = key;
+    }
+
+    double q[5] = {0.0, 0.1, 0.5, 0.9, 1.0}, r[5];
+    for (int i = 0; i < 5; i++) {
+        double pos = q[i] * (n - 1);
+        int lo = (int)pos, hi = lo + 1 < n ? lo + 1 : lo;
+        r[i] = v[lo] + (pos - lo) * (v[hi] - v[lo]);
+    }
+    free(v);
+    return (summary){r[0], r[1], r[2], r[3], r[4]};
+}
+
+// A phase over the ranks, each contributing the median of its runs. Imbalance is max / mean,
+// slowest the rank with the max.
+typedef struct {
+    double min, mean, max, imbalance;
+    int slowest;
+} rank_spread;
+
+static rank_spread spread_over_ranks(double v, int rank, int size) {
+    rank_spread s = {0};
+    struct {
+        double v;
+        int rank;
+    } in = {v, rank}, out;
+    MPI_Reduce(&v, &s.min, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&v, &s.mean, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&in, &out, 1, MPI_DOUBLE_INT, MPI_MAXLOC, 0, MPI_COMM_WORLD);
+    s.mean /= size;
+    s.max = out.v;
+    s.slowest = out.rank;
+    s.imbalance = s.mean > 0.0 ? s.max / s.mean : 1.0;
+    return s;
+}
+
+// Achieved bandwidth in GB/s of the kernels alone, timed on the slowest rank, and of the whole
+// product loop, for the lower bound and the no-reuse traffic of kernel_bytes
+typedef struct {
+    double kernel_min, kernel_max, total_min, total_max;
+} bandwidth;
+
+// Everything a run reports, gathered on rank 0. Run times are those of rank 0.
+typedef struct {
+    const char *strategy, *format;
+    int ranks, threads;
+    double l2, ops;
+    double comm_min, comm_max, comm_avg; // GB moved over all runs of one rank
+    int repeat;
+    phase_times *runs;
+    summary time[NUM_PHASES];
+    rank_spread spread[NUM_PHASES];
+    kernel_traffic bytes; // of one product, summed over the ranks
+    bandwidth achieved;
+    double stream;        // measured peak in GB/s, 0 if skipped
+    int counted;          // hardware events of every phase per product, summed over the ranks
+    int available[NUM_EVENTS];
+    event_counts events[NUM_PHASES];
+    int overlap, checked;
+    kernel_check check;
+} report;
+
+// Blocking exchanges are only timed with --overlap
+static int reported(report *r, int phase) { return r->overlap || phase != PHASE_BLOCKING; }
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// RFC 4180 field: always quoted, a quote inside is doubled
+static void csv_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"')
+            fputc('"', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+// One object per line, so that runs can be appended to the same file
+static void print_json(FILE *f, bench_state *b, report *r) {
+    fprintf(f, "{\"matrix\": ");
+    json_string(f, b->opt.path);
+    fprintf(f, ", \"strategy\": \"%s\", \"format\": \"%s\", \"ranks\": %d, \"threads\": %d", r->strategy,
+            r->format, r->ranks, r->threads);
+    fprintf(f, ", \"rows\": %d, \"nnz\": %lld, \"vectors\": %d, \"sstep\": %d, \"overlap\": %d", b->p[b->size],
+            b->nnz, b->opt.num_vectors, b->steps, r->overlap);
+    fprintf(f, ", \"iters\": %d, \"warmup\": %d, \"repeat\": %d, \"l2\": %.17g", b->opt.iters, b->opt.warmup,
+            r->repeat, r->l2);
+    fprintf(f, ", \"gflops\": %.9g, \"comm_gb\": {\"min\": %.9g, \"max\": %.9g, \"avg\": %.9g}",
+            r->ops / (r->time[PHASE_TOTAL].median * 1e9), r->comm_min, r->comm_max, r->comm_avg);
+    fprintf(f, ", \"bytes\": {\"matrix\": %.9g, \"x_min\": %.9g, \"x_max\": %.9g, \"y\": %.9g}", r->bytes.matrix,
+            r->bytes.x_min, r->bytes.x_max, r->bytes.y);
+    fprintf(f, ", \"bandwidth_gbs\": {\"kernel_min\": %.9g, \"kernel_max\": %.9g, \"total_min\": %.9g, "
+               "\"total_max\": %.9g}",
+            r->achieved.kernel_min, r->achieved.kernel_max, r->achieved.total_min, r->achieved.total_max);
+    if (r->stream > 0.0)
+        fprintf(f, ", \"stream_gbs\": %.9g, \"peak_pct\": {\"min\": %.9g, \"max\": %.9g}", r->stream,
+                100.0 * r->achieved.kernel_min / r->stream, 100.0 * r->achieved.kernel_max / r->stream);
+    for (int i = 0; i < NUM_PHASES; i++) {
+        if (!reported(r, i))
+            continue;
+        summary s = r->time[i];
+        rank_spread d = r->spread[i];
+        fprintf(f, ", \"%s\": {\"min\": %.9g, \"p10\": %.9g, \"median\": %.9g, \"p90\": %.9g, \"max\": %.9g",
+                phases[i].name, s.min, s.p10, s.median, s.p90, s.max);
+        fprintf(f, ", \"ranks\": {\"min\": %.9g, \"mean\": %.9g, \"max\": %.9g, \"imbalance\": %.9g, \"slowest\": %d}}",
+                d.min, d.mean, d.max, d.imbalance, d.slowest);
+    }
+    if (r->counted) {
+        fprintf(f, ", \"counters\": {");
+        for (int i = 0, first = 1; i < NUM_PHASES; i++) {
+            if (!reported(r, i) || r->events[i].count[EVENT_CYCLES] <= 0.0)
+                continue;
+            fprintf(f, "%s\"%s\": {", first ? "" : ", ", phases[i].name);
+            for (int e = 0, sep = 0; e < NUM_EVENTS; e++)
+                if (r->available[e])
+                    fprintf(f, "%s\"%s\": %.9g", sep++ ? ", " : "", event_names[e], r->events[i].count[e]);
+            fprintf(f, "}");
+            first = 0;
+        }
+        fprintf(f, "}");
+    }
+    if (r->checked)
+        fprintf(f, ", \"check\": {\"t_ref\": %.9g, \"t_kernel\": %.9g, \"rel_error\": %.9g}", r->check.t_ref,
+                r->check.t_kernel,
+                r->check.ref2 > 0.0 ? sqrt(r->check.err2 / r->check.ref2) : sqrt(r->check.err2));
+    fprintf(f, ", \"runs\": [");
+    for (int run = 0; run < r->repeat; run++) {
+        fprintf(f, "%s{", run > 0 ? ", " : "");
+        for (int i = 0; i < NUM_PHASES; i++)
+            if (reported(r, i))
+                fprintf(f, "%s\"%s\": %.9g", i > 0 ? ", " : "", phases[i].name, phase_time(&r->runs[run], i));
+        fprintf(f, "}");
+    }
+    fprintf(f, "]}\n");
+}
+
+// The phases whose hardware events get csv columns
+static const int csv_events[2] = {PHASE_SPMV, PHASE_COMM};
+
+// One row per run, a results file only gets the header while it is empty. Every phase has the
+// time of rank 0 in this run, then its spread over the ranks, which is the same for all runs.
+static void print_csv(FILE *f, bench_state *b, report *r) {
+    if (f == stdout || ftell(f) <= 0) {
+        fprintf(f, "matrix,strategy,format,ranks,threads,rows,nnz,vectors,sstep,overlap,iters,warmup,run,l2,gflops,"
+                   "bytes_min,bytes_max,kernel_gbs_min,kernel_gbs_max,stream_gbs");
+        for (int i = 0; i < NUM_PHASES; i++)
+            fprintf(f, ",%s,%s_rank_min,%s_rank_mean,%s_rank_max,%s_imbalance,%s_slowest", phases[i].name,
+                    phases[i].name, phases[i].name, phases[i].name, phases[i].name, phases[i].name);
+        for (int i = 0; i < 2; i++)
+            for (int e = 0; e < NUM_EVENTS; e++)
+                fprintf(f, ",%s_%s", phases[csv_events[i]].name, event_names[e]);
+        fprintf(f, "\n");
+    }
+    for (int run = 0; run < r->repeat; run++) {
+        csv_string(f, b->opt.path);
+        fprintf(f, ",%s,%s,%d,%d,%d,%lld,%d,%d,%d,%d,%d,%d,%.17g,%.9g", r->strategy, r->format, r->ranks,
+                r->threads, b->p[b->size], b->nnz, b->opt.num_vectors, b->steps, r->overlap, b->opt.iters,
+                b->opt.warmup, run, r->l2, r->ops / (r->runs[run].total * 1e9));
+        fprintf(f, ",%.9g,%.9g,%.9g,%.9g,%.9g", r->bytes.matrix + r->bytes.x_min + r->bytes.y,
+                r->bytes.matrix + r->bytes.x_max + r->bytes.y, r->achieved.kernel_min, r->achieved.kernel_max,
+                r->stream);
+        for (int i = 0; i < NUM_PHASES; i++) {
+            rank_spread d = r->spread[i];
+            fprintf(f, ",%.9g,%.9g,%.9g,%.9g,%.9g,%d", phase_time(&r->runs[run], i), d.min, d.mean, d.max,
+                    d.imbalance, d.slowest);
+        }
+        // Events per product of all runs, left empty when they were not counted
+        for (int i = 0; i < 2; i++)
+            for (int e = 0; e < NUM_EVENTS; e++)
+                if (r->counted && r->available[e])
+                    fprintf(f, ",%.9g", r->events[csv_events[i]].count[e]);
+                else
+                    fprintf(f, ",");
+        fprintf(f, "\n");
+    }
+}
+
+static void print_text(bench_state *b, const strategy *st, report *r) {
+    summary *t = r->time;
+    printf("Strategy = %s\n", r->strategy);
+    printf("Format = %s\n", r->format);
+    if (st->describe != NULL)
+        st->describe(b);
+    printf("L2 norm = %lf\n", r->l2);
+    printf("Total time = %lfs\n", t[PHASE_TOTAL].median);
+    printf("Communication time = %lfs\n", t[PHASE_COMM].median);
+    printf("Computation time = %lfs\n", t[PHASE_SPMV].median);
+    printf("GFLOPS = %lf\n", r->ops / (t[PHASE_TOTAL].median * 1e9));
+    printf("NFLOPS = %lf\n", r->ops);
+    printf("Comm min = %lf GB\nComm max = %lf GB\nComm avg = %lf GB\n", r->comm_min, r->comm_max, r->comm_avg);
+    printf("Bytes per product = %.3lf MB matrix, %.3lf-%.3lf MB x, %.3lf MB y\n", r->bytes.matrix / 1e6,
+           r->bytes.x_min / 1e6, r->bytes.x_max / 1e6, r->bytes.y / 1e6);
+    printf("Achieved bandwidth = %.2lf-%.2lf GB/s kernel, %.2lf-%.2lf GB/s overall\n", r->achieved.kernel_min,
+           r->achieved.kernel_max, r->achieved.total_min, r->achieved.total_max);
+    if (r->stream > 0.0)
+        printf("STREAM triad = %.2lf GB/s, kernel at %.1lf-%.1lf%% of peak\n", r->stream,
+               100.0 * r->achieved.kernel_min / r->stream, 100.0 * r->achieved.kernel_max / r->stream);
+    summary total = t[PHASE_TOTAL];
+    if (r->repeat > 1)
+        printf("Total time over %d runs: min = %lfs, p10 = %lfs, median = %lfs, p90 = %lfs, max = %lfs\n",
+               r->repeat, total.min, total.p10, total.median, total.p90, total.max);
+    if (r->overlap) {
+        double blocking = t[PHASE_BLOCKING].median;
+        double hidden = blocking > 0.0 ? 100.0 * (1.0 - t[PHASE_COMM].median / blocking) : 0.0;
+        printf("Blocking exchange time = %lfs\nHidden communication = %.1lf%%\n", blocking,
+               hidden > 0.0 ? hidden : 0.0);
+    }
+
+    printf("%-18s %12s %12s %12s %10s %8s\n", "Phase per rank", "min", "mean", "max", "max/mean", "slowest");
+    for (int i = 0; i < NUM_PHASES; i++) {
+        rank_spread d = r->spread[i];
+        if (reported(r, i) && d.max > 0.0)
+            printf("%-18s %11.6lfs %11.6lfs %11.6lfs %10.3lf %8d\n", phases[i].label, d.min, d.mean, d.max,
+                   d.imbalance, d.slowest);
+    }
+
+    if (b->opt.counters && !r->counted)
+        printf("Hardware counters unavailable\n");
+    if (r->counted) {
+        const char *headers[NUM_EVENTS] = {"cycles", "instructions", "LLC misses", "dTLB misses", "stall cycles"};
+        printf("%-18s", "Events per product");
+        for (int e = 0; e < NUM_EVENTS; e++)
+            printf(" %13s", headers[e]);
+        printf(" %6s\n", "IPC");
+        for (int i = 0; i < NUM_PHASES; i++) {
+            const double *c = r->events[i].count;
+            if (!reported(r, i) || c[EVENT_CYCLES] <= 0.0)
+                continue;
+            printf("%-18s", phases[i].label);
+            for (int e = 0; e < NUM_EVENTS; e++)
+                if (r->available[e])
+                    printf(" %13.0lf", c[e]);
+                else
+                    printf(" %13s", "n/a");
+            printf(" %6.2lf\n", c[EVENT_INSTRUCTIONS] / c[EVENT_CYCLES]);
+        }
+        if (r->available[EVENT_LLC_MISSES])
+            printf("LLC misses per nonzero = %.4lf\n",
+                   r->events[PHASE_SPMV].count[EVENT_LLC_MISSES] / ((double)b->nnz * b->opt.num_vectors));
+    }
+
+    if (r->checked)
+        print_kernel_check(b->k, r->check);
+}
+
+int main(int argc, char **argv) {
+    int rank, size;
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    options opt = parse_options(argc, argv, rank);
+    const strategy *st = find_strategy(opt.strategy);
+    if (st == NULL || (st == &strategy_sequential && size > 1)) {
+        if (rank == 0)
+            fprintf(stderr, st == NULL ? "Unknown strategy %s\n" : "Strategy %s runs on a single rank\n",
+                    opt.strategy);
+        MPI_Finalize();
+        return 1;
+    }
+    if ((opt.steps > 1 || opt.ingest) && !st->halo) {
+        if (rank == 0)
+            fprintf(stderr, "%s is only supported by strategy D\n", opt.steps > 1 ? "--sstep" : "--ingest");
+        MPI_Finalize();
+        return 1;
+    }
+    opt.part.node_of = find_rank_nodes(MPI_COMM_WORLD);
+    int nv = opt.num_vectors;
+
+    // Peak bandwidth first, while the matrix does not take any memory yet
+    double stream = 0.0;
+    if (opt.stream_mb > 0) {
+        int ranks_on_node = 0;
+        for (int r = 0; r < size; r++)
+            ranks_on_node += opt.part.node_of[r] == opt.part.node_of[rank];
+        size_t n = (size_t)opt.stream_mb * 1024 * 1024 / (3 * sizeof(double) * ranks_on_node);
+        stream = stream_triad(MPI_COMM_WORLD, n, 10) / 1e9;
+    }
+
+    bench_state b = {.opt = opt, .rank = rank, .size = size, .steps = 1};
+    b.p = calloc(size + 1, sizeof(int));
+    // Row-major blocks of nv vectors are exchanged as one element per row
+    MPI_Type_contiguous(nv, MPI_DOUBLE, &b.row_type);
+    MPI_Type_commit(&b.row_type);
+
+    st->setup(&b);
+
+    // tune_kernel ran on rank 0 only
+    MPI_Bcast(&b.opt.block_r, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&b.opt.block_c, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    // With --overlap, k covers the interior rows and kb the boundary rows that read the halo
+    int overlap = b.opt.overlap && st->overlaps;
+    int split = overlap ? interior_split(b.g, b.s, b.t) : b.s;
+    b.k = init_kernel(b.g, split, b.t, b.opt);
+    b.kb = overlap ? init_kernel(b.g, b.s, split, b.opt) : (kernel){0};
+
+    // Traffic and the reference check read the CSR rows, so they are taken before the plain sym
+    // kernel lets go of them: it covers every own row, which halves the matrix footprint
+    kernel_traffic own = kernel_bytes(b.k), boundary = kernel_bytes(b.kb);
+    int checked = opt.format != FORMAT_CSR;
+    kernel_check check = {0.0, 0.0, 0.0, 0.0};
+    if (checked) {
+        int whole = b.k.s == b.s && b.k.t == b.t;
+        kernel kc = whole ? b.k : init_kernel(b.g, b.s, b.t, b.opt);
+        check = reduce_kernel_check(check_kernel(kc, b.n, opt.iters));
+        if (!whole)
+            free_kernel(&kc);
+    }
+    if (b.k.format == FORMAT_SYM && !overlap && b.steps == 1) {
+        free_graph_entries(&b.g);
+        b.k.g = b.g;
+    }
+
+    b.x = malloc(sizeof(double) * b.n * nv);
+    b.y = malloc(sizeof(double) * b.n * nv);
+    reset_vectors(&b);
+    if (opt.counters)
+        b.counters = open_counters();
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    if (opt.warmup > 0) {
+        phase_times discard = {0};
+        st->run(&b, opt.warmup, &discard);
+    }
+
+    phase_times *runs = calloc(opt.repeat, sizeof(phase_times));
+    for (int r = 0; r < opt.repeat; r++) {
+        reset_vectors(&b);
+
+        // Blocking exchanges alone, the communication time that overlapping tries to hide
+        if (overlap) {
+            MPI_Barrier(MPI_COMM_WORLD);
+            stamp tb0 = take_stamp(&b);
+            for (int i = 0; i < opt.iters; i++)
+                st->exchange(&b);
+            add_phase(&runs[r], PHASE_BLOCKING, tb0, take_stamp(&b));
+        }
+
+        MPI_Barrier(MPI_COMM_WORLD);
+        stamp t0 = take_stamp(&b);
+        st->run(&b, opt.iters, &runs[r]);
+        add_phase(&runs[r], PHASE_TOTAL, t0, take_stamp(&b));
+        runs[r].comm = runs[r].pack + runs[r].post + runs[r].wait + runs[r].unpack;
+        for (int e = 0; e < NUM_EVENTS; e++)
+            for (int i = PHASE_PACK; i <= PHASE_UNPACK; i++)
+                runs[r].events[PHASE_COMM].count[e] += runs[r].events[i].count[e];
+    }
+
+    report rep = {.strategy = st->name,
+                  .format = format_name(b.k.format),
+                  .ranks = size,
+                  .threads = omp_get_max_threads(),
+                  .l2 = global_norm(&b),
+                  .ops = (double)b.nnz * 2.0 * opt.iters * nv,
+                  .repeat = opt.repeat,
+                  .runs = runs,
+                  .overlap = overlap,
+                  .checked = checked,
+                  .check = check};
+    for (int i = 0; i < NUM_PHASES; i++) {
+        rep.time[i] = summarize(runs, opt.repeat, i);
+        rep.spread[i] = spread_over_ranks(rep.time[i].median, rank, size);
+    }
+
+    double traffic[4] = {own.matrix + boundary.matrix, own.x_min + boundary.x_min, own.x_max + boundary.x_max,
+                         own.y + boundary.y};
+    MPI_Allreduce(MPI_IN_PLACE, traffic, 4, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    rep.bytes = (kernel_traffic){traffic[0], traffic[1], traffic[2], traffic[3]};
+    double bytes_min = (traffic[0] + traffic[1] + traffic[3]) * opt.iters / 1e9;
+    double bytes_max = (traffic[0] + traffic[2] + traffic[3]) * opt.iters / 1e9;
+    double t_kernel = rep.spread[PHASE_SPMV].max, t_total = rep.time[PHASE_TOTAL].median;
+    rep.achieved = (bandwidth){t_kernel > 0.0 ? bytes_min / t_kernel : 0.0, t_kernel > 0.0 ? bytes_max / t_kernel : 0.0,
+                               t_total > 0.0 ? bytes_min / t_total : 0.0, t_total > 0.0 ? bytes_max / t_total : 0.0};
+    rep.stream = stream;
+
+    // Events per product of every phase over all runs, summed over the ranks. An event counts
+    // only if every rank could count it.
+    int counting[1 + NUM_EVENTS] = {b.counters.threads > 0};
+    for (int e = 0; e < NUM_EVENTS; e++)
+        counting[1 + e] = counting[0] && b.counters.available[e];
+    MPI_Allreduce(MPI_IN_PLACE, counting, 1 + NUM_EVENTS, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    rep.counted = counting[0];
+    for (int e = 0; e < NUM_EVENTS; e++)
+        rep.available[e] = counting[1 + e];
+    if (rep.counted) {
+        event_counts own_events[NUM_PHASES] = {0};
+        for (int r = 0; r < opt.repeat; r++)
+            for (int i = 0; i < NUM_PHASES; i++)
+                for (int e = 0; e < NUM_EVENTS; e++)
+                    own_events[i].count[e] += runs[r].events[i].count[e] / ((double)opt.repeat * opt.iters);
+        MPI_Reduce(own_events, rep.events, NUM_PHASES * NUM_EVENTS, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    }
+
+    int exchanges = (opt.iters + b.steps - 1) / b.steps;
+    double comm = b.exchange_values * exchanges * nv * sizeof(double) / (1024.0 * 1024.0 * 1024.0);
+    MPI_Reduce(&comm, &rep.comm_min, 1, MPI_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&comm, &rep.comm_max, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&comm, &rep.comm_avg, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    rep.comm_avg /= size;
+
+    if (rank == 0) {
+        if (opt.output == OUTPUT_TEXT) {
+            print_text(&b, st, &rep);
+        } else {
+            FILE *f = opt.results != NULL ? fopen(opt.results, "a") : stdout;
+            if (f == NULL) {
+                fprintf(stderr, "Could not open %s\n", opt.results);
+                f = stdout;
+            }
+            if (opt.output == OUTPUT_JSON)
+                print_json(f, &b, &rep);
+            else
+                print_csv(f, &b, &rep);
+            if (f != stdout)
+                fclose(f);
+        }
+        fflush(stdout);
+    }
+
+    close_counters(&b.counters);
+    st->destroy(&b);
+    free_kernel(&b.k);
+    free_kernel(&b.kb);
+    free(b.x);
+    free(b.y);
+    free(b.p);
+    free(runs);
+    free(opt.part.node_of);
+    free_graph(&b.g);
+    MPI_Type_free(&b.row_type);
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "counters.h"
+#include "kernel.h"
+#include "options.h"
+#include <mpi.h>
+
+// The phase_times fields in report order
+enum { PHASE_TOTAL, PHASE_SPMV, PHASE_PACK, PHASE_POST, PHASE_WAIT, PHASE_UNPACK, PHASE_IDLE, PHASE_COMM,
+       PHASE_BLOCKING, NUM_PHASES };
+
+// Wall clock of one timed run on one rank, summed over its products
+typedef struct {
+    double total;
+    double spmv;                      // local products
+    double pack, post, wait, unpack;  // the steps of the exchanges
+    double idle;                      // barriers, i.e. waiting for slower ranks
+    double comm;                      // pack + post + wait + unpack, filled in by the driver
+    double blocking;                  // the same exchanges back to back without computation, --overlap only
+    event_counts events[NUM_PHASES];  // hardware events of every phase, --counters only
+} phase_times;
+
+// A point in time of one rank, with its hardware events so far when they are counted
+typedef struct {
+    double time;
+    event_counts events;
+} stamp;
+
+// State every strategy shares. x and y hold n rows of num_vectors values, rows [s, t) of g are
+// owned by this rank. A run reads x, writes y and swaps them after every product, so x always
+// holds the latest vector.
+typedef struct {
+    options opt;
+    int rank, size;
+    CSR g;
+    int *p;                  // rows of every rank, p[r]..p[r + 1], p[size] rows in total
+    long long nnz;           // nonzeros of the whole matrix
+    int n, s, t;
+    double *x, *y;
+    kernel k, kb;            // with --overlap, kb holds the boundary rows that read the halo
+    MPI_Datatype row_type;   // the num_vectors values of one row
+    double exchange_values;  // rows one exchange moves for this rank
+    int steps;               // products per exchange
+    perf_counters counters;  // threads == 0 unless --counters found a PMU
+    void *impl;              // strategy specific
+} bench_state;
+
+// A distributed SpMV scheme. setup distributes the matrix and fills g, p, nnz, n, s and t, the
+// driver then builds the kernels and vectors. run performs iters products and adds every phase
+// to t with add_phase, exchange is one blocking exchange of x on its own.
+typedef struct {
+    const char *name, *alias;
+    int overlaps; // honours --overlap
+    int halo;     // honours --sstep and --ingest, which need the rank-local halo layout
+    void (*setup)(bench_state *b);
+    void (*run)(bench_state *b, int iters, phase_times *t);
+    void (*exchange)(bench_state *b);
+    void (*describe)(bench_state *b); // extra text output on rank 0, may be NULL
+    void (*destroy)(bench_state *b);
+} strategy;
+
+extern const strategy strategy_sequential, strategy_allgather, strategy_separators, strategy_pairwise,
+    strategy_halo;
+
+stamp take_stamp(const bench_state *b);
+
+// Adds the time and the events between two stamps to a phase
+void add_phase(phase_times *t, int phase, stamp from, stamp to);
+
+// Broadcasts p from rank 0 and keeps the own rows of g there, see scatter_rows
+void distribute_rows(bench_state *b, CSR g);
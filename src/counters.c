@@ -0,0 +1,96 @@
+#include "counters.h"
+#include <omp.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+const char *const event_names[NUM_EVENTS] = {"cycles", "instructions", "llc_misses", "dtlb_misses", "stall_cycles"};
+
+#ifdef __linux__
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[NUM_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HW_CACHE,
+     PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND}};
+
+// User space only, which perf_event_paranoid = 2 still allows
+static int open_event(int e, int leader) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[e].type;
+    attr.config = events[e].config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+}
+#endif
+
+perf_counters open_counters(void) {
+    perf_counters c = {.threads = omp_get_max_threads()};
+    c.fd = malloc(sizeof(int) * c.threads * NUM_EVENTS);
+    for (int i = 0; i < c.threads * NUM_EVENTS; i++)
+        c.fd[i] = -1;
+
+#ifdef __linux__
+    // Counters follow the thread that opens them, which the OpenMP pool keeps for later regions
+#pragma omp parallel
+    {
+        int *fd = c.fd + omp_get_thread_num() * NUM_EVENTS;
+        fd[0] = open_event(0, -1);
+        for (int e = 1; e < NUM_EVENTS && fd[0] >= 0; e++)
+            fd[e] = open_event(e, fd[0]);
+    }
+#endif
+
+    for (int e = 0; e < NUM_EVENTS; e++) {
+        c.available[e] = 1;
+        for (int i = 0; i < c.threads; i++)
+            c.available[e] &= c.fd[i * NUM_EVENTS + e] >= 0;
+    }
+    if (!c.available[EVENT_CYCLES]) {
+        close_counters(&c);
+        c = (perf_counters){0};
+    }
+    return c;
+}
+
+void read_counters(const perf_counters *c, event_counts *e) {
+    memset(e, 0, sizeof(event_counts));
+    // nr, time enabled, time running, then the values in the order the events joined the group
+    uint64_t buf[3 + NUM_EVENTS];
+    for (int i = 0; i < c->threads; i++) {
+        const int *fd = c->fd + i * NUM_EVENTS;
+        if (read(fd[0], buf, sizeof(buf)) <= 0 || buf[2] == 0)
+            continue;
+        double scale = (double)buf[1] / buf[2];
+        for (int k = 0, pos = 0; k < NUM_EVENTS; k++) {
+            if (fd[k] < 0)
+                continue;
+            if (c->available[k])
+                e->count[k] += buf[3 + pos] * scale;
+            pos++;
+        }
+    }
+}
+
+void close_counters(perf_counters *c) {
+    for (int i = 0; i < c->threads * NUM_EVENTS; i++)
+        if (c->fd[i] >= 0)
+            close(c->fd[i]);
+    free(c->fd);
+    c->fd = NULL;
+    c->threads = 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// Hardware events read with perf_event_open, without PAPI. Every OpenMP thread counts its own
+// events in user space, so threads spinning at the end of a parallel region count as well.
+enum { EVENT_CYCLES, EVENT_INSTRUCTIONS, EVENT_LLC_MISSES, EVENT_DTLB_MISSES, EVENT_STALLS, NUM_EVENTS };
+
+extern const char *const event_names[NUM_EVENTS];
+
+typedef struct {
+    double count[NUM_EVENTS];
+} event_counts;
+
+// One event group per thread, led by the cycles. Events the CPU or the kernel does not offer,
+// e.g. the stall cycles on most Intel parts, are left out on every thread.
+typedef struct {
+    int threads;      // 0 if the cycles could not be counted, then nothing is
+    int *fd;          // threads * NUM_EVENTS descriptors, -1 where an event is missing
+    int available[NUM_EVENTS];
+} perf_counters;
+
+perf_counters open_counters(void);
+
+// Counts of this rank since open_counters, summed over the threads and scaled up when the
+// kernel had to multiplex the counters
+void read_counters(const perf_counters *c, event_counts *e);
+
+void close_counters(perf_counters *c);
@@ -0,0 +1,372 @@
+#include "csrcache.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CSR_CACHE_ALIGN 4096
+#define CSR_CACHE_MAX_MAPS 16
+
+static const char csr_cache_magic[8] = {'S', 'P', 'M', 'V', 'C', 'S', 'R', '\0'};
+static const char part_cache_magic[8] = {'S', 'P', 'M', 'V', 'P', 'R', 'T', '\0'};
+
+typedef struct {
+    char magic[8];
+    uint32_t version, header_size;
+    int64_t num_rows, nnz;
+    int64_t source_size, source_mtime; // the .mtx the cache was built from
+    uint64_t offset[3];                // row_ptr, col_idx, values
+    uint64_t checksum[3];
+} csr_cache_header;
+
+typedef struct {
+    char magic[8];
+    uint32_t version, header_size;
+    uint64_t key;
+    int64_t num_rows, k;
+    uint64_t checksum;
+} part_cache_header;
+
+// Mapped regions by the row_ptr they back, so free_graph can tell them from malloc'd graphs
+typedef struct {
+    int *key;
+    int num_maps;
+    void *addr[3];
+    size_t len[3];
+} csr_mapping;
+
+static csr_mapping mappings[CSR_CACHE_MAX_MAPS];
+
+static void cache_path(const char *path, char *out, size_t n) { snprintf(out, n, "%s.csr", path); }
+
+static uint64_t align_up(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+static uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// Sum of mixed, position-salted words: order independent, so it reduces in parallel
+static uint64_t checksum(const void *data, size_t bytes) {
+    const unsigned char *b = data;
+    size_t words = bytes / 8;
+    uint64_t h = 0;
+#pragma omp parallel for schedule(static) reduction(+ : h)
+    for (size_t i = 0; i < words; i++) {
+        uint64_t w;
+        memcpy(&w, b + i * 8, 8);
+        h += mix64(w ^ (i * 0x9e3779b97f4a7c15ull));
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, b + words * 8, bytes - words * 8);
+    return h + mix64(tail ^ (words * 0x9e3779b97f4a7c15ull)) + bytes;
+}
+
+static int source_stat(const char *path, int64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return 1;
+    *size = (int64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return 0;
+}
+
+static void register_mapping(csr_mapping m) {
+    for (int i = 0; i < CSR_CACHE_MAX_MAPS; i++) {
+        if (mappings[i].key == NULL) {
+            mappings[i] = m;
+            return;
+        }
+    }
+    // Table full: the mapping stays alive until exit, which is harmless
+}
+
+int save_csr_cache(const char *path, CSR g) {
+    csr_cache_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, csr_cache_magic, sizeof(h.magic));
+    h.version = CSR_CACHE_VERSION;
+    h.header_size = sizeof(h);
+    h.num_rows = g.num_rows;
+    h.nnz = g.num_cols;
+    if (source_stat(path, &h.source_size, &h.source_mtime))
+        return 1;
+
+    size_t bytes[3] = {sizeof(int) * ((size_t)g.num_rows + 1), sizeof(int) * (size_t)g.num_cols,
+                       sizeof(double) * (size_t)g.num_cols};
+    const void *data[3] = {g.row_ptr, g.col_idx, g.values};
+    uint64_t end = sizeof(h);
+    for (int a = 0; a < 3; a++) {
+        h.offset[a] = align_up(end, CSR_CACHE_ALIGN);
+        h.checksum[a] = checksum(data[a], bytes[a]);
+        end = h.offset[a] + bytes[a];
+    }
+
+    // Written under a temporary name and renamed, so readers never see a partial file
+    char final[4096], tmp[4112];
+    cache_path(path, final, sizeof(final));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", final);
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL)
+        return 1;
+
+    int err = fwrite(&h, sizeof(h), 1, f) != 1;
+    uint64_t pos = sizeof(h);
+    static const char zeros[CSR_CACHE_ALIGN] = {0};
+    for (int a = 0; a < 3 && !err; a++) {
+        err |= fwrite(zeros, 1, h.offset[a] - pos, f) != h.offset[a] - pos;
+        err |= fwrite(data[a], 1, bytes[a], f) != bytes[a];
+        pos = h.offset[a] + bytes[a];
+    }
+    err |= fclose(f) != 0;
+
+    if (err || rename(tmp, final) != 0) {
+        unlink(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+// Opens the cache and checks that its header matches the current .mtx
+static int open_cache(const char *path, csr_cache_header *h, size_t *file_size) {
+    char name[4096];
+    cache_path(path, name, sizeof(name));
+    int fd = open(name, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    int64_t size, mtime;
+    if (fstat(fd, &st) != 0 || pread(fd, h, sizeof(*h), 0) != (ssize_t)sizeof(*h) ||
+        memcmp(h->magic, csr_cache_magic, sizeof(h->magic)) != 0 || h->version != CSR_CACHE_VERSION ||
+        h->header_size != sizeof(*h) || source_stat(path, &size, &mtime) || size != h->source_size ||
+        mtime != h->source_mtime ||
+        h->offset[2] + sizeof(double) * (uint64_t)h->nnz > (uint64_t)st.st_size) {
+        close(fd);
+        return -1;
+    }
+
+    *file_size = (size_t)st.st_size;
+    return fd;
+}
+
+int load_csr_cache(const char *path, CSR *g) {
+    csr_cache_header h;
+    size_t file_size;
+    int fd = open_cache(path, &h, &file_size);
+    if (fd < 0)
+        return 1;
+
+    void *base = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return 1;
+
+    size_t bytes[3] = {sizeof(int) * ((size_t)h.num_rows + 1), sizeof(int) * (size_t)h.nnz,
+                       sizeof(double) * (size_t)h.nnz};
+    for (int a = 0; a < 3; a++) {
+        if (checksum((char *)base + h.offset[a], bytes[a]) != h.checksum[a]) {
+            munmap(base, file_size);
+            return 1;
+        }
+    }
+
+    g->num_rows = (int)h.num_rows;
+    g->num_cols = (int)h.nnz;
+    g->row_ptr = (int *)((char *)base + h.offset[0]);
+    g->col_idx = (int *)((char *)base + h.offset[1]);
+    g->values = (double *)((char *)base + h.offset[2]);
+    register_mapping((csr_mapping){.key = g->row_ptr, .num_maps = 1, .addr = {base}, .len = {file_size}});
+    return 0;
+}
+
+// Maps bytes [offset, offset + len) of fd, rounding the window out to whole pages
+static void *map_window(int fd, uint64_t offset, size_t len, csr_mapping *m) {
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = offset / page * page;
+    size_t window = (size_t)(offset - start) + (len > 0 ? len : 1);
+    void *addr = mmap(NULL, window, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, (off_t)start);
+    if (addr == MAP_FAILED)
+        return NULL;
+    m->addr[m->num_maps] = addr;
+    m->len[m->num_maps++] = window;
+    return (char *)addr + (offset - start);
+}
+
+int load_csr_cache_rows(const char *path, int s, int t, CSR *g) {
+    csr_cache_header h;
+    size_t file_size;
+    int fd = open_cache(path, &h, &file_size);
+    if (fd < 0)
+        return 1;
+    if (s < 0 || t < s || t > h.num_rows) {
+        close(fd);
+        return 1;
+    }
+
+    csr_mapping m = {.num_maps = 0};
+    int *row_ptr = map_window(fd, h.offset[0] + sizeof(int) * (uint64_t)s, sizeof(int) * ((size_t)(t - s) + 1), &m);
+    if (row_ptr == NULL || row_ptr[0] < 0 || row_ptr[t - s] < row_ptr[0] || row_ptr[t - s] > h.nnz) {
+        for (int i = 0; i < m.num_maps; i++)
+            munmap(m.addr[i], m.len[i]);
+        close(fd);
+        return 1;
+    }
+
+    int first = row_ptr[0], nnz = row_ptr[t - s] - row_ptr[0];
+    int *col_idx = map_window(fd, h.offset[1] + sizeof(int) * (uint64_t)first, sizeof(int) * (size_t)nnz, &m);
+    double *values = map_window(fd, h.offset[2] + sizeof(double) * (uint64_t)first, sizeof(double) * (size_t)nnz, &m);
+    close(fd);
+    if (col_idx == NULL || values == NULL) {
+        for (int i = 0; i < m.num_maps; i++)
+            munmap(m.addr[i], m.len[i]);
+        return 1;
+    }
+
+    // Private mapping, so rebasing only copies the row_ptr pages
+    for (int i = 0; i <= t - s; i++)
+        row_ptr[i] -= first;
+
+    g->num_rows = t - s;
+    g->num_cols = nnz;
+    g->row_ptr = row_ptr;
+    g->col_idx = col_idx;
+    g->values = values;
+    m.key = row_ptr;
+    register_mapping(m);
+    return 0;
+}
+
+int split_csr_cache(const char *path, int k, int *p) {
+    csr_cache_header h;
+    size_t file_size;
+    int fd = open_cache(path, &h, &file_size);
+    if (fd < 0)
+        return 1;
+
+    // Only the pages touched by the binary searches are read
+    csr_mapping m = {.num_maps = 0};
+    int *row_ptr = map_window(fd, h.offset[0], sizeof(int) * ((size_t)h.num_rows + 1), &m);
+    close(fd);
+    if (row_ptr == NULL)
+        return 1;
+
+    p[0] = 0;
+    for (int r = 1; r < k; r++) {
+        long long target = h.nnz * r / k;
+        int lo = p[r - 1], hi = (int)h.num_rows;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (row_ptr[mid] < target)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        p[r] = lo;
+    }
+    p[k] = (int)h.num_rows;
+
+    munmap(m.addr[0], m.len[0]);
+    return 0;
+}
+
+int release_csr_cache(CSR *g) {
+    if (g->row_ptr == NULL)
+        return 0;
+    for (int i = 0; i < CSR_CACHE_MAX_MAPS; i++) {
+        if (mappings[i].key == g->row_ptr) {
+            for (int j = 0; j < mappings[i].num_maps; j++)
+                munmap(mappings[i].addr[j], mappings[i].len[j]);
+            mappings[i].key = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Whole pages inside [data, data + bytes) only, a page shared with another array stays
+static void drop_pages(void *data, size_t bytes) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t a = ((uintptr_t)data + page - 1) / page * page, b = ((uintptr_t)data + bytes) / page * page;
+    if (a < b)
+        madvise((void *)a, b - a, MADV_DONTNEED);
+}
+
+int release_csr_cache_entries(CSR *g) {
+    if (g->row_ptr == NULL)
+        return 0;
+    for (int i = 0; i < CSR_CACHE_MAX_MAPS; i++) {
+        if (mappings[i].key == g->row_ptr) {
+            drop_pages(g->col_idx, sizeof(int) * (size_t)g->num_cols);
+            drop_pages(g->values, sizeof(double) * (size_t)g->num_cols);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+uint64_t partition_key(CSR g, int k, const int *params, int num_params, const int *groups) {
+    uint64_t key = mix64(checksum(g.row_ptr, sizeof(int) * ((size_t)g.num_rows + 1)));
+    key = mix64(key ^ checksum(g.col_idx, sizeof(int) * (size_t)g.num_cols));
+    key = mix64(key ^ (uint64_t)k);
+    if (groups != NULL)
+        key = mix64(key ^ checksum(groups, sizeof(int) * (size_t)k));
+    key = mix64(key ^ checksum(params, sizeof(int) * (size_t)num_params));
+    return mix64(key ^ PART_CACHE_VERSION);
+}
+
+static void part_path(const char *path, int k, char *out, size_t n) { snprintf(out, n, "%s.%d.part", path, k); }
+
+int save_partition_cache(const char *path, uint64_t key, int n, int k, const int *part) {
+    part_cache_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, part_cache_magic, sizeof(h.magic));
+    h.version = PART_CACHE_VERSION;
+    h.header_size = sizeof(h);
+    h.key = key;
+    h.num_rows = n;
+    h.k = k;
+    h.checksum = checksum(part, sizeof(int) * (size_t)n);
+
+    char final[4096], tmp[4112];
+    part_path(path, k, final, sizeof(final));
+    snprintf(tmp, sizeof(tmp), "%s.tmp", final);
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL)
+        return 1;
+
+    int err = fwrite(&h, sizeof(h), 1, f) != 1;
+    err |= fwrite(part, sizeof(int), (size_t)n, f) != (size_t)n;
+    err |= fclose(f) != 0;
+    if (err || rename(tmp, final) != 0) {
+        unlink(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+int load_partition_cache(const char *path, uint64_t key, int n, int k, int *part) {
+    char name[4096];
+    part_path(path, k, name, sizeof(name));
+    FILE *f = fopen(name, "rb");
+    if (f == NULL)
+        return 1;
+
+    part_cache_header h;
+    int err = fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, part_cache_magic, sizeof(h.magic)) != 0 ||
+              h.version != PART_CACHE_VERSION || h.header_size != sizeof(h) || h.key != key || h.num_rows != n ||
+              h.k != k;
+    err = err || fread(part, sizeof(int), (size_t)n, f) != (size_t)n;
+    fclose(f);
+    if (err || checksum(part, sizeof(int) * (size_t)n) != h.checksum)
+        return 1;
+
+    for (int i = 0; i < n; i++)
+        if (part[i] < 0 || part[i] >= k)
+            return 1;
+    return 0;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "mtx.h"
+#include <stdint.h>
+
+// Binary CSR written next to a .mtx as "<path>.csr" once it has been parsed, normalized and
+// sorted. Arrays are page aligned and checksummed, so later runs can mmap them directly.
+// Mappings are private and writable: in-place relabeling only copies the touched pages.
+// The version covers the parser output as well as the layout: bump it whenever the CSR built
+// from the same .mtx changes. 2: skew-symmetric mirrors negated, pattern and integer fields
+// read by the parallel parser. 3: duplicate entries summed.
+#define CSR_CACHE_VERSION 3
+
+int save_csr_cache(const char *path, CSR g);
+
+// Both return 0 on success, nonzero when the cache is missing, stale or corrupt
+int load_csr_cache(const char *path, CSR *g);
+
+// Rows [s, t) only, row_ptr starts at 0 and columns stay global. Checksums cover whole
+// arrays, so a partial load checks the header and bounds only.
+int load_csr_cache_rows(const char *path, int s, int t, CSR *g);
+
+// Contiguous rows balanced on nonzeros from the cached row_ptr: part r gets [p[r], p[r + 1])
+int split_csr_cache(const char *path, int k, int *p);
+
+// Unmaps g if its arrays come from a cache, returns 0 if g was not mapped
+int release_csr_cache(CSR *g);
+
+// Drops the pages of col_idx and values if g comes from a cache, the mapping itself stays
+// until release_csr_cache. Returns 0 if g was not mapped.
+int release_csr_cache_entries(CSR *g);
+
+// METIS part vectors stored as "<path>.<k>.part". The key hashes the structure of the matrix,
+// k and the partitioning options, so a file is only reused for the exact same problem.
+#define PART_CACHE_VERSION 1
+
+// params are the partitioning options that change the result, groups is the node of every
+// part for hierarchical partitions, NULL otherwise
+uint64_t partition_key(CSR g, int k, const int *params, int num_params, const int *groups);
+
+int save_partition_cache(const char *path, uint64_t key, int n, int k, const int *part);
+
+// Returns 0 on success, nonzero when the file is missing or belongs to another key
+int load_partition_cache(const char *path, uint64_t key, int n, int k, int *part);
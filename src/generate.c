@@ -0,0 +1,294 @@
+#include "generate.h"
+#include <limits.h>
+#include <math.h>
+#include <mpi.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const generator_names[NUM_GENERATORS] = {"stencil5", "stencil7", "stencil27",
+                                                            "banded",   "fem",      "rmat"};
+
+int is_generated(const char *path) { return strncmp(path, "gen:", 4) == 0; }
+
+int parse_generator(const char *spec, generator *gen) {
+    *gen = (generator){
+        .rows = 1000000, .bandwidth = 8, .dof = 3, .degree = 16, .a = 0.57, .b = 0.19, .c = 0.19, .seed = 1};
+    if (!is_generated(spec)) {
+        fprintf(stderr, "%s is not a generator\n", spec);
+        return 1;
+    }
+
+    const char *name = spec + 4;
+    size_t len = strcspn(name, ":");
+    int kind = -1;
+    for (int i = 0; i < NUM_GENERATORS; i++)
+        if (strlen(generator_names[i]) == len && strncmp(name, generator_names[i], len) == 0)
+            kind = i;
+    if (kind < 0) {
+        fprintf(stderr, "Unknown generator %.*s\n", (int)len, name);
+        return 1;
+    }
+    gen->kind = kind;
+
+    // key=value pairs, separated by commas
+    for (const char *p = name + len; *p != '\0';) {
+        p++;
+        size_t k = strcspn(p, "=,");
+        char *end;
+        double v = p[k] == '=' ? strtod(p + k + 1, &end) : 0.0;
+        if (p[k] != '=' || end == p + k + 1 || (*end != ',' && *end != '\0')) {
+            fprintf(stderr, "Invalid generator parameter %.*s\n", (int)strcspn(p, ","), p);
+            return 1;
+        }
+        if (k == 4 && strncmp(p, "rows", k) == 0)
+            gen->rows = (long long)v;
+        else if (k == 9 && strncmp(p, "rank_rows", k) == 0)
+            gen->rank_rows = (long long)v;
+        else if (k == 2 && strncmp(p, "bw", k) == 0)
+            gen->bandwidth = (int)v;
+        else if (k == 3 && strncmp(p, "dof", k) == 0)
+            gen->dof = (int)v;
+        else if (k == 3 && strncmp(p, "deg", k) == 0)
+            gen->degree = (int)v;
+        else if (k == 1 && *p == 'a')
+            gen->a = v;
+        else if (k == 1 && *p == 'b')
+            gen->b = v;
+        else if (k == 1 && *p == 'c')
+            gen->c = v;
+        else if (k == 4 && strncmp(p, "seed", k) == 0)
+            gen->seed = strtoull(p + k + 1, NULL, 10);
+        else {
+            fprintf(stderr, "Unknown generator parameter %.*s\n", (int)k, p);
+            return 1;
+        }
+        p = end;
+    }
+
+    double d = 1.0 - gen->a - gen->b - gen->c;
+    if (gen->rows < 1 || gen->rank_rows < 0 || gen->bandwidth < 0 || gen->dof < 1 || gen->degree < 1) {
+        fprintf(stderr, "Generator sizes must be positive\n");
+        return 1;
+    }
+    if (gen->a < 0.0 || gen->b < 0.0 || gen->c < 0.0 || d < -1e-12 || gen->a + gen->b <= 0.0 || gen->c + d <= 0.0) {
+        fprintf(stderr, "R-MAT probabilities a, b, c must be a distribution with a + b > 0 and c + d > 0\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Nearest grid of n points with the first dims sides equal
+static void fit_grid(long long n, int dims, int *nx, int *ny, int *nz) {
+    double side = dims == 2 ? sqrt((double)n) : cbrt((double)n);
+    long long a = llround(side) > 1 ? llround(side) : 1;
+    long long rest = dims == 2 ? llround((double)n / a) : llround((double)n / ((double)a * a));
+    *nx = (int)(a < INT_MAX ? a : INT_MAX);
+    *ny = dims == 2 ? (int)(rest > 1 ? (rest < INT_MAX ? rest : INT_MAX) : 1) : *nx;
+    *nz = dims == 2 ? 1 : (int)(rest > 1 ? (rest < INT_MAX ? rest : INT_MAX) : 1);
+}
+
+int resolve_generator(generator *gen, int ranks) {
+    long long total = gen->rank_rows > 0 ? gen->rank_rows * ranks : gen->rows, rows = 0;
+    gen->nx = gen->ny = gen->nz = 1;
+    switch (gen->kind) {
+    case GEN_STENCIL5:
+        fit_grid(total, 2, &gen->nx, &gen->ny, &gen->nz);
+        gen->max_row = 5;
+        break;
+    case GEN_STENCIL7:
+    case GEN_STENCIL27:
+        fit_grid(total, 3, &gen->nx, &gen->ny, &gen->nz);
+        gen->max_row = gen->kind == GEN_STENCIL7 ? 7 : 27;
+        break;
+    case GEN_FEM:
+        fit_grid(total / gen->dof > 1 ? total / gen->dof : 1, 3, &gen->nx, &gen->ny, &gen->nz);
+        gen->max_row = 27 * gen->dof;
+        break;
+    case GEN_BANDED:
+        gen->nx = total < INT_MAX ? (int)total : INT_MAX;
+        if (gen->bandwidth >= gen->nx)
+            gen->bandwidth = gen->nx - 1;
+        gen->max_row = 2LL * gen->bandwidth + 1 < INT_MAX ? 2 * gen->bandwidth + 1 : INT_MAX;
+        break;
+    case GEN_RMAT: {
+        gen->scale = llround(log2((double)total)) > 1 ? (int)llround(log2((double)total)) : 1;
+        gen->nx = gen->scale < 31 ? 1 << gen->scale : INT_MAX;
+        // The densest row takes the likelier half at every level
+        double p = gen->a + gen->b > 0.5 ? gen->a + gen->b : 1.0 - gen->a - gen->b;
+        double densest = gen->degree * pow(2.0 * p, gen->scale) + 2.0;
+        gen->max_row = densest < INT_MAX ? (int)densest : INT_MAX;
+        break;
+    }
+    default:
+        break;
+    }
+    rows = (long long)gen->nx * gen->ny * gen->nz * (gen->kind == GEN_FEM ? gen->dof : 1);
+    if (rows >= INT_MAX || gen->scale >= 31 || gen->max_row == INT_MAX) {
+        fprintf(stderr, "Generated matrix with %lld rows is too large\n", rows);
+        return 1;
+    }
+    gen->num_rows = (int)rows;
+    return 0;
+}
+
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Uniform in [0, 1), a function of the seed and three coordinates only
+static double uniform(uint64_t seed, uint64_t a, uint64_t b, uint64_t c) {
+    return (mix(mix(mix(seed ^ a) ^ b) ^ c) >> 11) * 0x1.0p-53;
+}
+
+static int compare_int(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Columns of row i in ascending order without duplicates, at most max_row of them
+static int generate_row(const generator *gen, int i, int *col) {
+    int n = 0;
+    switch (gen->kind) {
+    case GEN_STENCIL5:
+    case GEN_STENCIL7:
+    case GEN_STENCIL27:
+    case GEN_FEM: {
+        int dof = gen->kind == GEN_FEM ? gen->dof : 1, node = i / dof;
+        int nx = gen->nx, ny = gen->ny, nz = gen->nz;
+        int x = node % nx, y = (node / nx) % ny, z = node / nx / ny;
+        // Neighbours in (z, y, x) order have ascending indices
+        for (int dz = -1; dz <= 1; dz++)
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++) {
+                    int off_axis = (dx != 0) + (dy != 0) + (dz != 0);
+                    if ((gen->kind == GEN_STENCIL5 && (dz != 0 || off_axis > 1)) ||
+                        (gen->kind == GEN_STENCIL7 && off_axis > 1))
+                        continue;
+                    if (x + dx < 0 || x + dx >= nx || y + dy < 0 || y + dy >= ny || z + dz < 0 || z + dz >= nz)
+                        continue;
+                    int m = (x + dx) + nx * ((y + dy) + ny * (z + dz));
+                    for (int c = 0; c < dof; c++)
+                        col[n++] = m * dof + c;
+                }
+        return n;
+    }
+    case GEN_BANDED: {
+        int lo = i - gen->bandwidth > 0 ? i - gen->bandwidth : 0;
+        int hi = i + gen->bandwidth < gen->num_rows - 1 ? i + gen->bandwidth : gen->num_rows - 1;
+        for (int j = lo; j <= hi; j++)
+            col[n++] = j;
+        return n;
+    }
+    case GEN_RMAT: {
+        // Every edge picks a quadrant per level, a row bit of 0 with probability a + b. Given
+        // the row bits, the column bits are independent, so each row is sampled on its own:
+        // its expected entries, then a column bit per level conditioned on the row bit.
+        double a = gen->a, b = gen->b, c = gen->c, d = 1.0 - a - b - c;
+        double expected = gen->degree;
+        for (int l = gen->scale - 1; l >= 0; l--)
+            expected *= 2.0 * ((i >> l) & 1 ? c + d : a + b);
+        int count = (int)expected + (uniform(gen->seed, i, UINT64_MAX, 0) < expected - (int)expected);
+
+        // The diagonal keeps every row non-empty
+        col[n++] = i;
+        for (int k = 0; k < count; k++) {
+            int j = 0;
+            for (int l = gen->scale - 1; l >= 0; l--) {
+                double one = (i >> l) & 1 ? d / (c + d) : b / (a + b);
+                j = 2 * j + (uniform(gen->seed, i, k, l + 1) < one);
+            }
+            col[n++] = j;
+        }
+        qsort(col, n, sizeof(int), compare_int);
+        int kept = 1;
+        for (int k = 1; k < n; k++)
+            if (col[k] != col[kept - 1])
+                col[kept++] = col[k];
+        return kept;
+    }
+    default:
+        return 0;
+    }
+}
+
+CSR generate_rows(const generator *gen, int s, int t) {
+    CSR g = {.num_rows = t - s};
+    g.row_ptr = malloc(sizeof(int) * (t - s + 1));
+    g.row_ptr[0] = 0;
+
+    // Rows are built twice, to count and to fill, so every thread only holds one at a time
+    long long nnz = 0;
+#pragma omp parallel reduction(+ : nnz)
+    {
+        int *col = malloc(sizeof(int) * gen->max_row);
+#pragma omp for schedule(dynamic, 256)
+        for (int i = s; i < t; i++) {
+            g.row_ptr[i - s + 1] = generate_row(gen, i, col);
+            nnz += g.row_ptr[i - s + 1];
+        }
+        free(col);
+    }
+    if (nnz >= INT_MAX) {
+        fprintf(stderr, "Generated rows %d..%d hold %lld entries, too many for int indices\n", s, t, nnz);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    for (int i = 0; i < t - s; i++)
+        g.row_ptr[i + 1] += g.row_ptr[i];
+
+    g.num_cols = (int)nnz;
+    g.col_idx = malloc(sizeof(int) * (nnz + 1));
+    g.values = malloc(sizeof(double) * (nnz + 1));
+#pragma omp parallel
+    {
+        int *col = malloc(sizeof(int) * gen->max_row);
+#pragma omp for schedule(dynamic, 256)
+        for (int i = s; i < t; i++) {
+            int n = generate_row(gen, i, col);
+            int *dst = g.col_idx + g.row_ptr[i - s];
+            double *val = g.values + g.row_ptr[i - s];
+            for (int k = 0; k < n; k++) {
+                dst[k] = col[k];
+                val[k] = 2.0 * uniform(gen->seed, i, col[k], 0) - 1.0;
+            }
+        }
+        free(col);
+    }
+    return g;
+}
+
+void print_generator(const generator *gen) {
+    printf("Generated %s", generator_names[gen->kind]);
+    if (gen->kind == GEN_BANDED)
+        printf(" with bandwidth %d", gen->bandwidth);
+    else if (gen->kind == GEN_RMAT)
+        printf(" of scale %d, %d entries per row, a = %g, b = %g, c = %g", gen->scale, gen->degree, gen->a, gen->b,
+               gen->c);
+    else
+        printf(" on a %dx%dx%d grid", gen->nx, gen->ny, gen->nz);
+    if (gen->kind == GEN_FEM)
+        printf(" with %d dof per node", gen->dof);
+    printf(", seed %llu\n", gen->seed);
+}
+
+CSR generate_graph(const char *spec) {
+    generator gen;
+    int ranks;
+    MPI_Comm_size(MPI_COMM_WORLD, &ranks);
+    if (parse_generator(spec, &gen) != 0 || resolve_generator(&gen, ranks) != 0)
+        MPI_Abort(MPI_COMM_WORLD, 1);
+
+    double t0 = MPI_Wtime();
+    CSR g = generate_rows(&gen, 0, gen.num_rows);
+    print_generator(&gen);
+    printf("Done generating in %.3fs\n", MPI_Wtime() - t0);
+    printf("|V|=%d |E|=%d\n", g.num_rows, g.num_cols);
+
+    printf("Normalizing graph\n");
+    normalize_graph(g);
+    return g;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "mtx.h"
+
+// Synthetic matrices, given in place of a .mtx path as gen:<kind>[:key=value,...]
+//   stencil5, stencil7, stencil27  2D 5-point, 3D 7- and 27-point stencils on a grid
+//   banded                         every column within bw of the diagonal
+//   fem                            nodes of a 3D grid holding dof unknowns, neighbouring
+//                                  nodes coupled by dense dof x dof blocks
+//   rmat                           R-MAT power-law graph with deg entries per row on average
+//                                  and quadrant probabilities a, b, c, plus the diagonal
+// The size is rows in total or rank_rows per rank, the latter for weak scaling. Grids are as
+// close to square or cubic as the size allows, rmat rounds to a power of two. Every row
+// depends on seed and its index only, so any rank can build any rows and the result does not
+// depend on the thread or rank count.
+typedef enum {
+    GEN_STENCIL5,
+    GEN_STENCIL7,
+    GEN_STENCIL27,
+    GEN_BANDED,
+    GEN_FEM,
+    GEN_RMAT,
+    NUM_GENERATORS
+} generator_kind;
+
+typedef struct {
+    generator_kind kind;
+    long long rows, rank_rows; // requested size, rank_rows wins when both are given
+    int bandwidth, dof, degree;
+    double a, b, c;
+    unsigned long long seed;
+    // Set by resolve_generator
+    int num_rows;
+    int nx, ny, nz; // grid of the stencils and of the fem nodes
+    int scale;      // rmat rows are 2^scale
+    int max_row;    // bound on the entries of one row before duplicates are merged
+} generator;
+
+int is_generated(const char *path);
+
+// Returns 0 if spec is valid, prints the reason to stderr otherwise
+int parse_generator(const char *spec, generator *gen);
+
+// Fixes the size for the given number of ranks, returns 0 unless it does not fit in an int
+int resolve_generator(generator *gen, int ranks);
+
+// One line naming the kind, the resolved size and the parameters
+void print_generator(const generator *gen);
+
+// Rows [s, t) of a resolved generator, row_ptr starts at 0 and columns are global. Values are
+// uniform in [-1, 1) and not normalized.
+CSR generate_rows(const generator *gen, int s, int t);
+
+// The whole matrix for the ranks of MPI_COMM_WORLD, normalized like a parsed .mtx
+CSR generate_graph(const char *spec);
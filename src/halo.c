@@ -0,0 +1,121 @@
+#include "halo.h"
+#include <stdlib.h>
+
+// Below this many values the OpenMP fork costs more than the copy
+#define HALO_PARALLEL_MIN 4096
+
+static void flatten_lists(int size, int rank, int *count, int **items, int *num, int **ranks, int **ptr,
+                          int **flat) {
+    *num = 0;
+    for (int r = 0; r < size; r++)
+        if (r != rank && count[r] > 0)
+            (*num)++;
+
+    *ranks = malloc(sizeof(int) * (*num + 1));
+    *ptr = malloc(sizeof(int) * (*num + 1));
+    (*ptr)[0] = 0;
+    int n = 0;
+    for (int r = 0; r < size; r++) {
+        if (r != rank && count[r] > 0) {
+            (*ranks)[n] = r;
+            (*ptr)[n + 1] = (*ptr)[n] + count[r];
+            n++;
+        }
+    }
+
+    *flat = malloc(sizeof(int) * ((*ptr)[*num] + 1));
+    for (int i = 0; i < *num; i++)
+        for (int j = 0; j < count[(*ranks)[i]]; j++)
+            (*flat)[(*ptr)[i] + j] = items[(*ranks)[i]][j];
+}
+
+halo_exchange init_halo_exchange(comm_lists c, int rank, int size, int k) {
+    halo_exchange h = {.k = k};
+    flatten_lists(size, rank, c.send_count, c.send_items, &h.num_send, &h.send_ranks, &h.send_ptr, &h.send_items);
+    flatten_lists(size, rank, c.receive_count, c.receive_items, &h.num_recv, &h.recv_ranks, &h.recv_ptr,
+                  &h.recv_items);
+
+    // Edges are weighted by the number of items they carry
+    int *recv_weights = malloc(sizeof(int) * (h.num_recv + 1));
+    int *send_weights = malloc(sizeof(int) * (h.num_send + 1));
+    for (int i = 0; i < h.num_recv; i++)
+        recv_weights[i] = h.recv_ptr[i + 1] - h.recv_ptr[i];
+    for (int i = 0; i < h.num_send; i++)
+        send_weights[i] = h.send_ptr[i + 1] - h.send_ptr[i];
+    MPI_Dist_graph_create_adjacent(MPI_COMM_WORLD, h.num_recv, h.recv_ranks, recv_weights, h.num_send, h.send_ranks,
+                                   send_weights, MPI_INFO_NULL, 0, &h.comm);
+    free(recv_weights);
+    free(send_weights);
+
+    h.send_buffer = malloc(sizeof(double) * ((size_t)h.send_ptr[h.num_send] * k + 1));
+    h.recv_buffer = malloc(sizeof(double) * ((size_t)h.recv_ptr[h.num_recv] * k + 1));
+    h.requests = malloc(sizeof(MPI_Request) * (h.num_send + h.num_recv + 1));
+
+    for (int i = 0; i < h.num_recv; i++)
+        MPI_Recv_init(h.recv_buffer + (size_t)h.recv_ptr[i] * k, (h.recv_ptr[i + 1] - h.recv_ptr[i]) * k,
+                      MPI_DOUBLE, h.recv_ranks[i], 0, h.comm, &h.requests[i]);
+    for (int i = 0; i < h.num_send; i++)
+        MPI_Send_init(h.send_buffer + (size_t)h.send_ptr[i] * k, (h.send_ptr[i + 1] - h.send_ptr[i]) * k,
+                      MPI_DOUBLE, h.send_ranks[i], 0, h.comm, &h.requests[h.num_recv + i]);
+
+    return h;
+}
+
+void halo_exchange_pack(halo_exchange *h, double *y) {
+    int n = h->send_ptr[h->num_send], k = h->k;
+
+#pragma omp parallel for schedule(static) if (n * k >= HALO_PARALLEL_MIN)
+    for (int i = 0; i < n; i++)
+        for (int l = 0; l < k; l++)
+            h->send_buffer[(size_t)i * k + l] = y[(size_t)h->send_items[i] * k + l];
+}
+
+void halo_exchange_post(halo_exchange *h) { MPI_Startall(h->num_recv + h->num_send, h->requests); }
+
+void halo_exchange_wait(halo_exchange *h) {
+    MPI_Waitall(h->num_recv + h->num_send, h->requests, MPI_STATUSES_IGNORE);
+}
+
+void halo_exchange_unpack(halo_exchange *h, double *y) {
+    int n = h->recv_ptr[h->num_recv], k = h->k;
+
+#pragma omp parallel for schedule(static) if (n * k >= HALO_PARALLEL_MIN)
+    for (int i = 0; i < n; i++)
+        for (int l = 0; l < k; l++)
+            y[(size_t)h->recv_items[i] * k + l] = h->recv_buffer[(size_t)i * k + l];
+}
+
+void halo_exchange_begin(halo_exchange *h, double *y) {
+    halo_exchange_pack(h, y);
+    halo_exchange_post(h);
+}
+
+void halo_exchange_end(halo_exchange *h, double *y) {
+    halo_exchange_wait(h);
+    halo_exchange_unpack(h, y);
+}
+
+void halo_exchange_run(halo_exchange *h, double *y) {
+    halo_exchange_begin(h, y);
+    halo_exchange_end(h, y);
+}
+
+void free_halo_exchange(halo_exchange *h) {
+    for (int i = 0; i < h->num_send + h->num_recv; i++)
+        MPI_Request_free(&h->requests[i]);
+    MPI_Comm_free(&h->comm);
+    free(h->requests);
+    free(h->send_buffer);
+    free(h->recv_buffer);
+    free(h->send_ranks);
+    free(h->recv_ranks);
+    free(h->send_ptr);
+    free(h->recv_ptr);
+    free(h->send_items);
+    free(h->recv_items);
+    h->requests = NULL;
+    h->send_buffer = NULL;
+    h->recv_buffer = NULL;
+    h->num_send = 0;
+    h->num_recv = 0;
+}
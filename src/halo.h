@@ -0,0 +1,36 @@
+#pragma once
+#include "spmv.h"
+#include <mpi.h>
+
+// Halo exchange with the neighbours of one rank, set up once from its comm_lists. Items for
+// neighbour i are packed at [send_ptr[i], send_ptr[i + 1]) of the fixed buffers, so the
+// persistent requests can be restarted every iteration without any allocation.
+typedef struct {
+    MPI_Comm comm; // distributed graph topology, ranks are not reordered
+    int k;         // values per item
+    int num_send, num_recv;
+    int *send_ranks, *recv_ranks;
+    int *send_ptr, *recv_ptr;
+    int *send_items, *recv_items;
+    double *send_buffer, *recv_buffer;
+    MPI_Request *requests; // receives first, then sends
+} halo_exchange;
+
+halo_exchange init_halo_exchange(comm_lists c, int rank, int size, int k);
+
+// The steps of an exchange, begin packs and posts, end waits and unpacks
+void halo_exchange_pack(halo_exchange *h, double *y);
+
+void halo_exchange_post(halo_exchange *h);
+
+void halo_exchange_wait(halo_exchange *h);
+
+void halo_exchange_unpack(halo_exchange *h, double *y);
+
+void halo_exchange_begin(halo_exchange *h, double *y);
+
+void halo_exchange_end(halo_exchange *h, double *y);
+
+void halo_exchange_run(halo_exchange *h, double *y);
+
+void free_halo_exchange(halo_exchange *h);
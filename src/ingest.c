@@ -0,0 +1,339 @@
+#include "ingest.h"
+#include "csrcache.h"
+#include "generate.h"
+#include <math.h>
+#include <mpi.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INGEST_HEADER_BYTES (1 << 16)
+#define INGEST_MARGIN (1 << 12)
+#define INGEST_MAX_READ (1 << 30)
+#define INGEST_BINS_PER_RANK 1024
+
+static int owner_of(int *p, int size, int gid) {
+    int lo = 0, hi = size - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (p[mid] <= gid)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+// MPI-IO counts are ints, so reads go in pieces of at most INGEST_MAX_READ bytes. The
+// collective version runs as many rounds as the largest slice needs.
+static void read_slice(MPI_File fh, long long offset, char *buf, long long len, int collective) {
+    long long rounds = (len + INGEST_MAX_READ - 1) / INGEST_MAX_READ;
+    if (collective)
+        MPI_Allreduce(MPI_IN_PLACE, &rounds, 1, MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD);
+
+    for (long long i = 0; i < rounds; i++) {
+        long long a = i * INGEST_MAX_READ < len ? i * INGEST_MAX_READ : len;
+        int n = len - a < INGEST_MAX_READ ? (int)(len - a) : INGEST_MAX_READ;
+        if (collective)
+            MPI_File_read_at_all(fh, offset + a, buf + a, n, MPI_CHAR, MPI_STATUS_IGNORE);
+        else
+            MPI_File_read_at(fh, offset + a, buf + a, n, MPI_CHAR, MPI_STATUS_IGNORE);
+    }
+}
+
+// Whether the first n bytes of the file hold the banner and the whole size line
+static int has_size_line(const char *data, size_t n, int at_eof) {
+    const char *end = data + n, *q = memchr(data, '\n', n);
+    while (q != NULL) {
+        const char *line = q + 1;
+        while (line < end && (*line == ' ' || *line == '\t'))
+            line++;
+        q = line < end ? memchr(line, '\n', end - line) : NULL;
+        if (line < end && *line != '%' && *line != '\n' && *line != '\r')
+            return q != NULL || at_eof;
+    }
+    return at_eof;
+}
+
+// Contiguous rows from a histogram of entries per bin of rows_per_bin rows
+static void split_bins(long long *hist, int nb, int rows_per_bin, int n, int size, int *p) {
+    long long total = 0, acc = 0;
+    for (int b = 0; b < nb; b++)
+        total += hist[b];
+
+    int r = 1;
+    p[0] = 0;
+    for (int b = 0; b < nb && r < size; b++) {
+        acc += hist[b];
+        while (r < size && acc >= total * r / size) {
+            long long bound = (long long)(b + 1) * rows_per_bin;
+            p[r++] = bound < n ? (int)bound : n;
+        }
+    }
+    while (r < size)
+        p[r++] = n;
+    p[size] = n;
+}
+
+// normalize_graph over the rows of all ranks
+static void normalize_distributed(CSR g, int rank) {
+    double sum = 0.0;
+    long long nnz = g.num_cols;
+#pragma omp parallel for schedule(static) reduction(+ : sum)
+    for (int i = 0; i < g.num_cols; i++)
+        sum += g.values[i];
+    MPI_Allreduce(MPI_IN_PLACE, &sum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &nnz, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        printf("Mean of graph: %f\n", sum);
+        fflush(stdout);
+    }
+
+    if (sum == 0.0) // All zero input
+    {
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < g.num_cols; i++)
+            g.values[i] = 2.0;
+        return;
+    }
+
+    double mean = sum / (double)nnz, std = 0.0;
+#pragma omp parallel for schedule(static) reduction(+ : std)
+    for (int i = 0; i < g.num_cols; i++)
+        std += (g.values[i] - mean) * (g.values[i] - mean);
+    MPI_Allreduce(MPI_IN_PLACE, &std, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    std = sqrt(std / (double)nnz);
+    if (rank == 0)
+        printf("Std of graph: %f\n", std);
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < g.num_cols; i++)
+        g.values[i] = (g.values[i] - mean) / (std + __DBL_EPSILON__);
+}
+
+// Rank r parses the lines that start in its 1/size share of the body. It reads one byte in
+// front of the share to tell whether the share starts a line, and past its end until the
+// last line it owns is complete.
+static CSR ingest_mtx(const char *path, int *p, int rank, int size) {
+    double t0 = MPI_Wtime();
+    MPI_File fh;
+    if (MPI_File_open(MPI_COMM_WORLD, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        if (rank == 0)
+            fprintf(stderr, "Could not open %s\n", path);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_Offset file_size;
+    MPI_File_get_size(fh, &file_size);
+
+    mtx m = {0};
+    long long body = 0;
+    if (rank == 0) {
+        size_t n = INGEST_HEADER_BYTES;
+        char *data = NULL;
+        for (;;) {
+            n = n < (size_t)file_size ? n : (size_t)file_size;
+            data = realloc(data, n + 1);
+            read_slice(fh, 0, data, (long long)n, 0);
+            if (has_size_line(data, n, n == (size_t)file_size))
+                break;
+            n *= 2;
+        }
+        const char *first = parse_mtx_header(data, data + n, &m);
+        // The other ranks already wait in the broadcast below
+        if (first == NULL)
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        body = first - data;
+        free(data);
+    }
+
+    int header[5] = {m.symmetry, m.field, m.M, m.N, m.L};
+    MPI_Bcast(header, 5, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&body, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+    m = (mtx){.symmetry = header[0], .field = header[1], .M = header[2], .N = header[3]};
+
+    long long len = file_size - body;
+    long long s = body + len * rank / size, t = body + len * (rank + 1) / size;
+    long long lo = s - 1, hi = t + INGEST_MARGIN < file_size ? t + INGEST_MARGIN : file_size;
+    char *buf = malloc(hi - lo + 1);
+    read_slice(fh, lo, buf, hi - lo, 1);
+
+    for (long long margin = 2 * INGEST_MARGIN; hi < file_size && memchr(buf + (t - 1 - lo), '\n', hi - t + 1) == NULL;
+         margin *= 2) {
+        long long next = t + margin < file_size ? t + margin : file_size;
+        buf = realloc(buf, next - lo + 1);
+        read_slice(fh, hi, buf + (hi - lo), next - hi, 0);
+        hi = next;
+    }
+    MPI_File_close(&fh);
+
+    const char *end = buf + (hi - lo), *stop = buf + (t - lo), *start = buf + 1;
+    if (buf[0] != '\n') {
+        start = memchr(buf + 1, '\n', end - buf - 1);
+        start = start != NULL ? start + 1 : end;
+    }
+    int errors = parse_mtx_entries(start < stop ? start : stop, stop, end, &m);
+    free(buf);
+
+    long long entries = m.L;
+    MPI_Allreduce(MPI_IN_PLACE, &errors, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &entries, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if (errors > 0 || entries != header[4]) {
+        if (rank == 0)
+            fprintf(stderr, "Invalid matrix entries: %lld lines for %d entries, %d malformed\n", entries, header[4],
+                    errors);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    double t1 = MPI_Wtime();
+    if (rank == 0) {
+        printf("Done ingesting mtx on %d ranks, %.1f MB in %.3fs (%.2f GB/s)\n", size, file_size / 1e6, t1 - t0,
+               file_size / ((t1 - t0) * 1e9));
+        printf("Header: M = %d, N = %d, entries = %d\n", m.M, m.N, header[4]);
+        fflush(stdout);
+    }
+
+    // Parts balance the entries including mirrors, counted on bins of rows
+    int n = m.N > m.M ? m.N : m.M, mirror = m.symmetry != GENERAL;
+    int rows_per_bin = n / (size * INGEST_BINS_PER_RANK) > 1 ? n / (size * INGEST_BINS_PER_RANK) : 1;
+    int nb = (n + rows_per_bin - 1) / rows_per_bin;
+    long long *hist = calloc(nb + 1, sizeof(long long));
+    for (int i = 0; i < m.L; i++) {
+        hist[(m.I[i] - 1) / rows_per_bin]++;
+        if (mirror && m.I[i] != m.J[i])
+            hist[(m.J[i] - 1) / rows_per_bin]++;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, hist, nb, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    split_bins(hist, nb, rows_per_bin, n, size, p);
+    free(hist);
+
+    // Every entry and its mirror go to the owners of their rows. Each rank packs in file
+    // order and receives by source rank, so duplicates are summed in file order as in coo_to_csr.
+    int *scount = calloc(size, sizeof(int)), *sdispl = malloc(sizeof(int) * size);
+    int *rcount = malloc(sizeof(int) * size), *rdispl = malloc(sizeof(int) * size);
+    for (int i = 0; i < m.L; i++) {
+        scount[owner_of(p, size, m.I[i] - 1)]++;
+        if (mirror && m.I[i] != m.J[i])
+            scount[owner_of(p, size, m.J[i] - 1)]++;
+    }
+    MPI_Alltoall(scount, 1, MPI_INT, rcount, 1, MPI_INT, MPI_COMM_WORLD);
+    sdispl[0] = rdispl[0] = 0;
+    for (int r = 1; r < size; r++) {
+        sdispl[r] = sdispl[r - 1] + scount[r - 1];
+        rdispl[r] = rdispl[r - 1] + rcount[r - 1];
+    }
+    int num_send = sdispl[size - 1] + scount[size - 1], num_recv = rdispl[size - 1] + rcount[size - 1];
+
+    int *sI = malloc(sizeof(int) * (num_send + 1)), *sJ = malloc(sizeof(int) * (num_send + 1));
+    double *sA = malloc(sizeof(double) * (num_send + 1));
+    int *cursor = malloc(sizeof(int) * size);
+    memcpy(cursor, sdispl, sizeof(int) * size);
+    for (int i = 0; i < m.L; i++) {
+        int k = cursor[owner_of(p, size, m.I[i] - 1)]++;
+        sI[k] = m.I[i];
+        sJ[k] = m.J[i];
+        sA[k] = m.A[i];
+        if (mirror && m.I[i] != m.J[i]) {
+            k = cursor[owner_of(p, size, m.J[i] - 1)]++;
+            sI[k] = m.J[i];
+            sJ[k] = m.I[i];
+            sA[k] = m.symmetry == SKEW_SYMMETRIC ? -m.A[i] : m.A[i];
+        }
+    }
+    internal_free_mtx(&m);
+
+    mtx own = {.symmetry = GENERAL, .field = header[1], .M = p[rank + 1] - p[rank], .N = n, .L = num_recv};
+    own.I = malloc(sizeof(int) * (num_recv + 1));
+    own.J = malloc(sizeof(int) * (num_recv + 1));
+    own.A = malloc(sizeof(double) * (num_recv + 1));
+    MPI_Alltoallv(sI, scount, sdispl, MPI_INT, own.I, rcount, rdispl, MPI_INT, MPI_COMM_WORLD);
+    MPI_Alltoallv(sJ, scount, sdispl, MPI_INT, own.J, rcount, rdispl, MPI_INT, MPI_COMM_WORLD);
+    MPI_Alltoallv(sA, scount, sdispl, MPI_DOUBLE, own.A, rcount, rdispl, MPI_DOUBLE, MPI_COMM_WORLD);
+    free(sI);
+    free(sJ);
+    free(sA);
+    free(cursor);
+    free(scount);
+    free(sdispl);
+    free(rcount);
+    free(rdispl);
+
+    for (int i = 0; i < num_recv; i++)
+        own.I[i] -= p[rank];
+    CSR g = coo_to_csr(&own, own.M);
+
+    if (rank == 0)
+        printf("Normalizing graph\n");
+    normalize_distributed(g, rank);
+    return g;
+}
+
+// Every rank builds its own rows. Parts balance the entries, counted on bins of rows of an even
+// split, which each rank builds once beforehand.
+static CSR ingest_generated(const char *path, int *p, int rank, int size) {
+    generator gen;
+    if (parse_generator(path, &gen) != 0 || resolve_generator(&gen, size) != 0)
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    double t0 = MPI_Wtime();
+
+    int n = gen.num_rows;
+    int rows_per_bin = n / (size * INGEST_BINS_PER_RANK) > 1 ? n / (size * INGEST_BINS_PER_RANK) : 1;
+    int nb = (n + rows_per_bin - 1) / rows_per_bin;
+    long long *hist = calloc(nb + 1, sizeof(long long));
+    int s = (int)((long long)n * rank / size), t = (int)((long long)n * (rank + 1) / size);
+    CSR share = generate_rows(&gen, s, t);
+    for (int i = s; i < t; i++)
+        hist[i / rows_per_bin] += share.row_ptr[i - s + 1] - share.row_ptr[i - s];
+    free_graph(&share);
+    MPI_Allreduce(MPI_IN_PLACE, hist, nb, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    split_bins(hist, nb, rows_per_bin, n, size, p);
+    free(hist);
+
+    CSR g = generate_rows(&gen, p[rank], p[rank + 1]);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if (rank == 0) {
+        print_generator(&gen);
+        printf("Done generating on %d ranks in %.3fs\n", size, MPI_Wtime() - t0);
+        printf("Normalizing graph\n");
+        fflush(stdout);
+    }
+    normalize_distributed(g, rank);
+    return g;
+}
+
+CSR ingest_graph(const char *path, int *p, int rank, int size) {
+    CSR g = {0};
+    if (is_generated(path)) {
+        g = ingest_generated(path, p, rank, size);
+        long long nnz = g.num_cols;
+        MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &nnz, &nnz, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+        if (rank == 0) {
+            printf("|V|=%d |E|=%lld\n", p[size], nnz);
+            fflush(stdout);
+        }
+        return g;
+    }
+
+    // A valid cache is already normalized, every rank maps its own rows of it
+    int failed = rank == 0 ? split_csr_cache(path, size, p) : 0;
+    MPI_Bcast(&failed, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!failed) {
+        MPI_Bcast(p, size + 1, MPI_INT, 0, MPI_COMM_WORLD);
+        failed = load_csr_cache_rows(path, p[rank], p[rank + 1], &g);
+        MPI_Allreduce(MPI_IN_PLACE, &failed, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+        if (failed)
+            free_graph(&g);
+        else if (rank == 0)
+            printf("Loaded rows of binary cache %s.csr on %d ranks\n", path, size);
+    }
+    if (failed)
+        g = ingest_mtx(path, p, rank, size);
+
+    long long nnz = g.num_cols;
+    MPI_Reduce(rank == 0 ? MPI_IN_PLACE : &nnz, &nnz, 1, MPI_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("|V|=%d |E|=%lld\n", p[size], nnz);
+        fflush(stdout);
+    }
+    return g;
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include "mtx.h"
+
+// Distributed input: every rank reads its own slice of the .mtx with MPI-IO, or maps its rows
+// of a valid binary cache, so no rank ever holds the whole matrix. p is filled with a
+// contiguous partition balanced on nonzeros and the rank returns rows [p[rank], p[rank + 1])
+// of the normalized matrix, columns keep their global numbering.
+CSR ingest_graph(const char *path, int *p, int rank, int size);
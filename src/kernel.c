@@ -0,0 +1,248 @@
+#include "kernel.h"
+#include "spmv.h"
+#include <math.h>
+#include <mpi.h>
+#include <omp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *format_names[NUM_FORMATS] = {"csr", "sell", "bcsr", "fp32", "bf16", "sym"};
+
+int parse_format(const char *name) {
+    for (int i = 0; i < NUM_FORMATS; i++)
+        if (strcmp(name, format_names[i]) == 0)
+            return i;
+    return -1;
+}
+
+const char *format_name(int format) { return format >= 0 && format < NUM_FORMATS ? format_names[format] : "unknown"; }
+
+static int gcd(int a, int b) { return b == 0 ? a : gcd(b, a % b); }
+
+// Format analysis on the whole matrix, done on rank 0 before partitioning
+void tune_kernel(CSR g, options *opt) {
+    if (opt->format != FORMAT_BCSR)
+        return;
+
+    if (opt->block_r <= 0 || opt->block_c <= 0)
+        bcsr_detect_block_size(g, 0, g.num_rows, &opt->block_r, &opt->block_c);
+
+    opt->part.block_size = opt->block_r / gcd(opt->block_r, opt->block_c) * opt->block_c;
+    printf("BCSR block size %dx%d, fill = %.3f\n", opt->block_r, opt->block_c,
+           bcsr_fill_ratio(g, 0, g.num_rows, opt->block_r, opt->block_c));
+}
+
+kernel init_kernel(CSR g, int s, int t, options opt) {
+    kernel k = {.format = opt.format, .s = s, .t = t, .g = g, .schedule = opt.schedule, .num_vectors = opt.num_vectors};
+
+    // Empty ranges occur when a rank has no boundary or no interior rows
+    if (s >= t) {
+        k.format = FORMAT_CSR;
+        k.schedule = SCHEDULE_STATIC;
+        return k;
+    }
+
+    // Thread decompositions are computed once here and reused by every call
+    if (k.format == FORMAT_CSR && k.schedule != SCHEDULE_STATIC) {
+        k.num_threads = omp_get_max_threads();
+        if (k.schedule == SCHEDULE_NNZ) {
+            k.bounds = malloc(sizeof(int) * (k.num_threads + 1));
+            partition_graph_naive(g, s, t, k.num_threads, k.bounds);
+        } else {
+            k.merge = init_merge_schedule(g, s, t, k.num_threads);
+        }
+    }
+
+    if (k.format == FORMAT_SELL)
+        k.sell = build_sell(g, s, t, opt.sell_c, opt.sell_sigma);
+
+    if (k.format == FORMAT_BCSR) {
+        if (opt.block_r <= 0 || opt.block_c <= 0)
+            bcsr_detect_block_size(g, s, t, &opt.block_r, &opt.block_c);
+        k.bcsr = build_bcsr(g, s, t, opt.block_r, opt.block_c);
+    }
+
+    if (k.format == FORMAT_FP32 || k.format == FORMAT_BF16)
+        k.mixed = build_mixed(g, s, t, k.format == FORMAT_FP32 ? PRECISION_FP32 : PRECISION_BF16);
+
+    if (k.format == FORMAT_SYM) {
+        if (is_symmetric(g, s, t)) {
+            k.sym = build_sym(g, s, t, omp_get_max_threads());
+        } else {
+            printf("Rows %d-%d are not symmetric, using csr\n", s, t);
+            k.format = FORMAT_CSR;
+        }
+    }
+
+    return k;
+}
+
+void spmv_kernel(kernel k, double *x, double *y) {
+    if (k.num_vectors > 1) {
+        spmm_part(k.g, 0, k.s, k.t, k.num_vectors, x, y);
+        return;
+    }
+
+    switch (k.format) {
+    case FORMAT_SELL:
+        spmv_sell(k.sell, k.s, x, y);
+        break;
+    case FORMAT_BCSR:
+        spmv_bcsr(k.bcsr, k.s, x, y);
+        break;
+    case FORMAT_FP32:
+    case FORMAT_BF16:
+        spmv_mixed(k.mixed, k.s, k.t, x, y);
+        break;
+    case FORMAT_SYM:
+        spmv_sym(k.sym, k.s, x, y);
+        break;
+    default:
+        if (k.schedule == SCHEDULE_MERGE)
+            spmv_part_merge(k.g, k.merge, x, y);
+        else if (k.schedule == SCHEDULE_NNZ)
+            spmv_part_balanced(k.g, k.bounds, k.num_threads, x, y);
+        else
+            spmv_part(k.g, 0, k.s, k.t, x, y);
+        break;
+    }
+}
+
+// V[0] holds the own rows and the ghosts up to m.steps hops away, V[1..steps] are computed
+// from it. Ghost rows are recomputed redundantly, so no exchange is needed in between.
+void matrix_powers(kernel k, powers_plan m, int steps, double **V) {
+    for (int j = 1; j <= steps; j++) {
+        spmv_kernel(k, V[j - 1], V[j]);
+        spmv_rows(k.g, m.ghost_rows, m.ghost_ptr[steps - j], V[j - 1], V[j]);
+    }
+}
+
+void free_kernel(kernel *k) {
+    if (k->format == FORMAT_CSR && k->schedule == SCHEDULE_NNZ)
+        free(k->bounds);
+    if (k->format == FORMAT_CSR && k->schedule == SCHEDULE_MERGE)
+        free_merge_schedule(&k->merge);
+    if (k->format == FORMAT_SELL)
+        free_sell(&k->sell);
+    if (k->format == FORMAT_BCSR)
+        free_bcsr(&k->bcsr);
+    if (k->format == FORMAT_FP32 || k->format == FORMAT_BF16)
+        free_mixed(&k->mixed);
+    if (k->format == FORMAT_SYM)
+        free_sym(&k->sym);
+}
+
+// Distinct columns of rows [s, t), each is the smallest x traffic of a product
+static long long distinct_columns(CSR g, int s, int t) {
+    int max_col = -1;
+    for (int i = g.row_ptr[s]; i < g.row_ptr[t]; i++)
+        max_col = g.col_idx[i] > max_col ? g.col_idx[i] : max_col;
+
+    char *seen = calloc(max_col + 2, 1);
+    long long count = 0;
+    for (int i = g.row_ptr[s]; i < g.row_ptr[t]; i++) {
+        count += !seen[g.col_idx[i]];
+        seen[g.col_idx[i]] = 1;
+    }
+    free(seen);
+    return count;
+}
+
+kernel_traffic kernel_bytes(kernel k) {
+    kernel_traffic b = {0.0, 0.0, 0.0, 0.0};
+    if (k.s >= k.t)
+        return b;
+
+    double n = k.t - k.s, nnz = k.g.row_ptr[k.t] - k.g.row_ptr[k.s], nv = k.num_vectors;
+    double csr_index = (n + 1) * sizeof(int) + nnz * sizeof(int);
+    // Entries the kernel multiplies, explicit zeros of padded formats included
+    double entries = nnz;
+
+    switch (k.format) {
+    case FORMAT_SELL: {
+        double slots = k.sell.chunk_ptr[k.sell.num_chunks];
+        // chunk_ptr, chunk_len and perm, then the padded columns and values
+        b.matrix = (2.0 * k.sell.num_chunks + 1 + n) * sizeof(int) + slots * (sizeof(int) + sizeof(double));
+        entries = slots;
+        break;
+    }
+    case FORMAT_BCSR: {
+        BCSR m = k.bcsr;
+        double blocks = m.num_blocks;
+        b.matrix = (m.num_block_rows + 1.0) * sizeof(int) + blocks * sizeof(int) + blocks * m.r * m.c * sizeof(double);
+        // A block reads c entries of x for its r rows
+        entries = blocks * m.c;
+        break;
+    }
+    case FORMAT_FP32:
+        b.matrix = csr_index + nnz * sizeof(float);
+        break;
+    case FORMAT_BF16:
+        b.matrix = csr_index + nnz * sizeof(uint16_t);
+        break;
+    case FORMAT_SYM: {
+        // Half of the entries are stored, every one of them also updates y of its column
+        double stored = k.sym.row_ptr[k.sym.num_rows], halo = k.sym.halo_ptr[k.sym.num_rows];
+        b.matrix = 2.0 * (n + 1) * sizeof(int) + (stored + halo) * (sizeof(int) + sizeof(double));
+        entries = stored + halo;
+        b.y = 2.0 * stored * sizeof(double);
+        break;
+    }
+    default:
+        b.matrix = csr_index + nnz * sizeof(double);
+        break;
+    }
+
+    b.x_min = distinct_columns(k.g, k.s, k.t) * sizeof(double) * nv;
+    b.x_max = entries * sizeof(double) * nv;
+    b.y += n * sizeof(double) * nv;
+    return b;
+}
+
+// x has length n and is filled with a fixed pattern, so every format sees the same input
+kernel_check check_kernel(kernel k, int n, int iters) {
+    kernel_check c = {0.0, 0.0, 0.0, 0.0};
+    double *x = malloc(sizeof(double) * n);
+    double *y = malloc(sizeof(double) * k.t);
+    double *y_ref = malloc(sizeof(double) * k.t);
+
+    for (int i = 0; i < n; i++)
+        x[i] = 1.0 + 0.25 * (i % 7);
+
+    double t0 = omp_get_wtime();
+    for (int i = 0; i < iters; i++)
+        spmv_part(k.g, 0, k.s, k.t, x, y_ref);
+    double t1 = omp_get_wtime();
+    for (int i = 0; i < iters; i++)
+        spmv_kernel(k, x, y);
+    double t2 = omp_get_wtime();
+
+    c.t_ref = t1 - t0;
+    c.t_kernel = t2 - t1;
+    for (int u = k.s; u < k.t; u++) {
+        c.err2 += (y[u] - y_ref[u]) * (y[u] - y_ref[u]);
+        c.ref2 += y_ref[u] * y_ref[u];
+    }
+
+    free(x);
+    free(y);
+    free(y_ref);
+    return c;
+}
+
+kernel_check reduce_kernel_check(kernel_check c) {
+    kernel_check r;
+    MPI_Allreduce(&c.t_ref, &r.t_ref, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(&c.t_kernel, &r.t_kernel, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    MPI_Allreduce(&c.err2, &r.err2, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(&c.ref2, &r.ref2, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    return r;
+}
+
+void print_kernel_check(kernel k, kernel_check c) {
+    printf("Reference csr time = %lfs\n", c.t_ref);
+    printf("Kernel %s time = %lfs\n", format_name(k.format), c.t_kernel);
+    printf("Kernel speedup = %lf\n", c.t_ref / c.t_kernel);
+    printf("Relative L2 error = %e\n", c.ref2 > 0.0 ? sqrt(c.err2 / c.ref2) : sqrt(c.err2));
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "bcsr.h"
+#include "mixed.h"
+#include "mtx.h"
+#include "options.h"
+#include "sell.h"
+#include "spmv.h"
+#include "sym.h"
+
+typedef enum { FORMAT_CSR, FORMAT_SELL, FORMAT_BCSR, FORMAT_FP32, FORMAT_BF16, FORMAT_SYM, NUM_FORMATS } spmv_format;
+
+// A local SpMV operator for rows [s, t) of g, stored in the format selected at runtime
+typedef struct {
+    int format;
+    int s, t;
+    CSR g;
+    int schedule, num_threads;
+    int num_vectors; // width of the row-major x and y blocks, csr only
+    int *bounds;
+    merge_schedule merge;
+    SELL sell;
+    BCSR bcsr;
+    CSR_mixed mixed;
+    CSR_sym sym;
+} kernel;
+
+// Compute-only comparison of a kernel against the double precision CSR reference
+typedef struct {
+    double t_ref, t_kernel;
+    double err2, ref2; // squared L2 norms of y - y_ref and of y_ref
+} kernel_check;
+
+// Bytes one product moves through memory. matrix covers every array the format streams, y is
+// written once, x is read either once per distinct column (lower bound) or once per stored
+// entry (no cache reuse at all).
+typedef struct {
+    double matrix, x_min, x_max, y;
+} kernel_traffic;
+
+int parse_format(const char *name);
+
+const char *format_name(int format);
+
+void tune_kernel(CSR g, options *opt);
+
+kernel init_kernel(CSR g, int s, int t, options opt);
+
+void spmv_kernel(kernel k, double *x, double *y);
+
+void matrix_powers(kernel k, powers_plan m, int steps, double **V);
+
+void free_kernel(kernel *k);
+
+kernel_traffic kernel_bytes(kernel k);
+
+kernel_check check_kernel(kernel k, int n, int iters);
+
+kernel_check reduce_kernel_check(kernel_check c);
+
+void print_kernel_check(kernel k, kernel_check c);
@@ -0,0 +1,362 @@
+#include "local.h"
+#include <mpi.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCATTER_CHUNK (1 << 24)
+#define SCATTER_WINDOW 16
+
+static int compare_int(const void *a, const void *b) {
+    int ia = *(const int *)a, ib = *(const int *)b;
+    return (ia > ib) - (ia < ib);
+}
+
+static int owner_of(int *p, int size, int gid) {
+    int lo = 0, hi = size - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (p[mid] <= gid)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+static int find_sorted(int *a, int n, int v) {
+    int *hit = bsearch(&v, a, n, sizeof(int), compare_int);
+    return hit != NULL ? (int)(hit - a) : -1;
+}
+
+static void prefix_sum(int *count, int *displ, int size) {
+    displ[0] = 0;
+    for (int r = 1; r < size; r++)
+        displ[r] = displ[r - 1] + count[r - 1];
+}
+
+// Sends ids[sdispl[r]..sdispl[r] + scount[r]) to rank r, returns what every rank sent here
+static int *alltoall_ids(int size, int *ids, int *scount, int *sdispl, int *rcount, int *rdispl) {
+    MPI_Alltoall(scount, 1, MPI_INT, rcount, 1, MPI_INT, MPI_COMM_WORLD);
+    prefix_sum(rcount, rdispl, size);
+    int *rids = malloc(sizeof(int) * (rdispl[size - 1] + rcount[size - 1] + 1));
+    MPI_Alltoallv(ids, scount, sdispl, MPI_INT, rids, rcount, rdispl, MPI_INT, MPI_COMM_WORLD);
+    return rids;
+}
+
+// Sends n elements from data to dest in messages of at most SCATTER_CHUNK elements, reusing
+// the SCATTER_WINDOW slots of window so that only a bounded number of sends is in flight
+static void send_chunked(const void *data, long long n, MPI_Datatype type, int dest, int tag, MPI_Request *window,
+                         int *used) {
+    int elem;
+    MPI_Type_size(type, &elem);
+    for (long long a = 0; a < n; a += SCATTER_CHUNK) {
+        int slot;
+        if (*used < SCATTER_WINDOW)
+            slot = (*used)++;
+        else
+            MPI_Waitany(SCATTER_WINDOW, window, &slot, MPI_STATUS_IGNORE);
+        int count = n - a < SCATTER_CHUNK ? (int)(n - a) : SCATTER_CHUNK;
+        MPI_Isend((const char *)data + a * elem, count, type, dest, tag, MPI_COMM_WORLD, &window[slot]);
+    }
+}
+
+// Posts the receives matching send_chunked, messages with one tag arrive in order
+static void recv_chunked(void *data, long long n, MPI_Datatype type, int tag, MPI_Request *requests, int *num) {
+    int elem;
+    MPI_Type_size(type, &elem);
+    for (long long a = 0; a < n; a += SCATTER_CHUNK) {
+        int count = n - a < SCATTER_CHUNK ? (int)(n - a) : SCATTER_CHUNK;
+        MPI_Irecv((char *)data + a * elem, count, type, 0, tag, MPI_COMM_WORLD, &requests[(*num)++]);
+    }
+}
+
+// Every rank receives rows [p[rank], p[rank + 1]) of g, which only rank 0 holds. Columns
+// keep their global numbering. Rank 0 streams each part in chunks, so no message and no
+// count exceeds an int and the transfers to later ranks start while earlier ones drain.
+CSR scatter_graph(CSR g, int *p, int rank, int size) {
+    CSR l = {.num_rows = p[rank + 1] - p[rank]};
+    // Only read on rank 0, but every rank passes a valid send buffer to the scatter
+    long long *nnz_counts = calloc(size, sizeof(long long)), nnz = 0;
+
+    if (rank == 0) {
+        for (int r = 0; r < size; r++)
+            nnz_counts[r] = (long long)g.row_ptr[p[r + 1]] - g.row_ptr[p[r]];
+    }
+    MPI_Scatter(nnz_counts, 1, MPI_LONG_LONG, &nnz, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD);
+
+    l.num_cols = (int)nnz;
+    l.row_ptr = malloc(sizeof(int) * (l.num_rows + 1));
+    l.col_idx = malloc(sizeof(int) * (nnz + 1));
+    l.values = malloc(sizeof(double) * (nnz + 1));
+
+    if (rank == 0) {
+        MPI_Request window[SCATTER_WINDOW];
+        int used = 0;
+        for (int r = 1; r < size; r++) {
+            long long first = g.row_ptr[p[r]];
+            send_chunked(g.row_ptr + p[r], (long long)(p[r + 1] - p[r]) + 1, MPI_INT, r, 0, window, &used);
+            send_chunked(g.col_idx + first, nnz_counts[r], MPI_INT, r, 1, window, &used);
+            send_chunked(g.values + first, nnz_counts[r], MPI_DOUBLE, r, 2, window, &used);
+        }
+
+        memcpy(l.row_ptr, g.row_ptr + p[0], sizeof(int) * (l.num_rows + 1));
+        memcpy(l.col_idx, g.col_idx + g.row_ptr[p[0]], sizeof(int) * nnz);
+        memcpy(l.values, g.values + g.row_ptr[p[0]], sizeof(double) * nnz);
+        MPI_Waitall(used, window, MPI_STATUSES_IGNORE);
+    } else {
+        long long chunks = ((long long)l.num_rows + 1 + SCATTER_CHUNK - 1) / SCATTER_CHUNK +
+                           2 * ((nnz + SCATTER_CHUNK - 1) / SCATTER_CHUNK);
+        MPI_Request *requests = malloc(sizeof(MPI_Request) * chunks);
+        int num = 0;
+        recv_chunked(l.row_ptr, (long long)l.num_rows + 1, MPI_INT, 0, requests, &num);
+        recv_chunked(l.col_idx, nnz, MPI_INT, 1, requests, &num);
+        recv_chunked(l.values, nnz, MPI_DOUBLE, 2, requests, &num);
+        MPI_Waitall(num, requests, MPI_STATUSES_IGNORE);
+        free(requests);
+    }
+
+    int base = l.row_ptr[0];
+    for (int i = 0; i <= l.num_rows; i++)
+        l.row_ptr[i] -= base;
+
+    free(nnz_counts);
+    return l;
+}
+
+CSR scatter_rows(CSR g, int *p, int rank, int size) {
+    CSR l = scatter_graph(g, p, rank, size);
+    int n = p[size], s = p[rank], t = p[rank + 1];
+
+    int *row_ptr = malloc(sizeof(int) * (n + 1));
+#pragma omp parallel for schedule(static)
+    for (int u = 0; u <= n; u++)
+        row_ptr[u] = u <= s ? 0 : u >= t ? l.num_cols : l.row_ptr[u - s];
+
+    free(l.row_ptr);
+    l.row_ptr = row_ptr;
+    l.num_rows = n;
+    return l;
+}
+
+// Rows gids[0..n) from their owners, gids are sorted so each owner gets one contiguous request
+static CSR fetch_rows(CSR own, int *p, int rank, int size, int *gids, int n) {
+    int *scount = calloc(size, sizeof(int)), *sdispl = malloc(sizeof(int) * size);
+    int *rcount = malloc(sizeof(int) * size), *rdispl = malloc(sizeof(int) * size);
+    for (int i = 0; i < n; i++)
+        scount[owner_of(p, size, gids[i])]++;
+    prefix_sum(scount, sdispl, size);
+
+    int *req = alltoall_ids(size, gids, scount, sdispl, rcount, rdispl);
+    int num_req = rdispl[size - 1] + rcount[size - 1];
+
+    // Row lengths travel back first, they size the entry exchange
+    int *len = malloc(sizeof(int) * (num_req + 1));
+    for (int i = 0; i < num_req; i++) {
+        int u = req[i] - p[rank];
+        len[i] = own.row_ptr[u + 1] - own.row_ptr[u];
+    }
+
+    CSR rows = {.num_rows = n, .row_ptr = malloc(sizeof(int) * (n + 1))};
+    rows.row_ptr[0] = 0;
+    MPI_Alltoallv(len, rcount, rdispl, MPI_INT, rows.row_ptr + 1, scount, sdispl, MPI_INT, MPI_COMM_WORLD);
+    for (int i = 0; i < n; i++)
+        rows.row_ptr[i + 1] += rows.row_ptr[i];
+    rows.num_cols = rows.row_ptr[n];
+
+    int *out_count = calloc(size, sizeof(int)), *out_displ = malloc(sizeof(int) * size);
+    int *in_count = malloc(sizeof(int) * size), *in_displ = malloc(sizeof(int) * size);
+    for (int r = 0; r < size; r++) {
+        for (int i = rdispl[r]; i < rdispl[r] + rcount[r]; i++)
+            out_count[r] += len[i];
+        in_count[r] = rows.row_ptr[sdispl[r] + scount[r]] - rows.row_ptr[sdispl[r]];
+    }
+    prefix_sum(out_count, out_displ, size);
+    prefix_sum(in_count, in_displ, size);
+
+    int num_out = out_displ[size - 1] + out_count[size - 1];
+    int *out_idx = malloc(sizeof(int) * (num_out + 1));
+    double *out_val = malloc(sizeof(double) * (num_out + 1));
+    for (int i = 0, k = 0; i < num_req; i++) {
+        int u = req[i] - p[rank];
+        for (int j = own.row_ptr[u]; j < own.row_ptr[u + 1]; j++, k++) {
+            out_idx[k] = own.col_idx[j];
+            out_val[k] = own.values[j];
+        }
+    }
+
+    rows.col_idx = malloc(sizeof(int) * (rows.num_cols + 1));
+    rows.values = malloc(sizeof(double) * (rows.num_cols + 1));
+    MPI_Alltoallv(out_idx, out_count, out_displ, MPI_INT, rows.col_idx, in_count, in_displ, MPI_INT,
+                  MPI_COMM_WORLD);
+    MPI_Alltoallv(out_val, out_count, out_displ, MPI_DOUBLE, rows.values, in_count, in_displ, MPI_DOUBLE,
+                  MPI_COMM_WORLD);
+
+    free(scount);
+    free(sdispl);
+    free(rcount);
+    free(rdispl);
+    free(req);
+    free(len);
+    free(out_count);
+    free(out_displ);
+    free(in_count);
+    free(in_displ);
+    free(out_idx);
+    free(out_val);
+    return rows;
+}
+
+// Sorted, unique columns of rows that are neither owned nor already on an earlier level
+static int next_level(CSR rows, int s, int t, int **levels, int *level_size, int l, int **out) {
+    int *cand = malloc(sizeof(int) * (rows.num_cols + 1));
+    int n = 0;
+    for (int i = 0; i < rows.num_cols; i++)
+        if (rows.col_idx[i] < s || rows.col_idx[i] >= t)
+            cand[n++] = rows.col_idx[i];
+    qsort(cand, n, sizeof(int), compare_int);
+
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        if (m > 0 && cand[m - 1] == cand[i])
+            continue;
+        int seen = 0;
+        for (int j = 1; j < l && !seen; j++)
+            seen = find_sorted(levels[j], level_size[j], cand[i]) >= 0;
+        if (!seen)
+            cand[m++] = cand[i];
+    }
+
+    *out = cand;
+    return m;
+}
+
+// Turns the row block from scatter_graph into rank-local storage. Ghost rows are fetched for
+// levels below depth, columns are renumbered into the local index space, and c is filled
+// with local indices: receives write straight into the ghost region.
+local_layout localize_graph(CSR *g, int *p, int rank, int size, int depth, comm_lists c) {
+    local_layout lay = {.offset = p[rank], .num_owned = p[rank + 1] - p[rank], .depth = depth};
+    int s = p[rank], t = p[rank + 1];
+
+    long long nnz = g->num_cols;
+    MPI_Allreduce(&nnz, &lay.global_nnz, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+    // levels[l] holds the sorted global ids at distance l, ghost_rows[l] their rows
+    int **levels = malloc(sizeof(int *) * (depth + 1));
+    int *level_size = malloc(sizeof(int) * (depth + 1));
+    CSR *ghost_rows = malloc(sizeof(CSR) * (depth + 1));
+    CSR frontier = *g;
+    for (int l = 1; l <= depth; l++) {
+        level_size[l] = next_level(frontier, s, t, levels, level_size, l, &levels[l]);
+        if (l < depth) {
+            ghost_rows[l] = fetch_rows(*g, p, rank, size, levels[l], level_size[l]);
+            frontier = ghost_rows[l];
+        }
+    }
+
+    lay.level_ptr = malloc(sizeof(int) * (depth + 1));
+    lay.level_ptr[0] = 0;
+    for (int l = 1; l <= depth; l++)
+        lay.level_ptr[l] = lay.level_ptr[l - 1] + level_size[l];
+    lay.num_ghosts = lay.level_ptr[depth];
+    lay.num_rows = lay.num_owned + lay.level_ptr[depth - 1];
+
+    lay.ghost_gid = malloc(sizeof(int) * (lay.num_ghosts + 1));
+    for (int l = 1; l <= depth; l++)
+        memcpy(lay.ghost_gid + lay.level_ptr[l - 1], levels[l], sizeof(int) * level_size[l]);
+
+    // Owned rows, then ghost rows level by level, with local column indices
+    CSR loc = {.num_rows = lay.num_rows, .row_ptr = malloc(sizeof(int) * (lay.num_rows + 1))};
+    loc.row_ptr[0] = 0;
+    for (int u = 0; u < lay.num_owned; u++)
+        loc.row_ptr[u + 1] = g->row_ptr[u + 1];
+    for (int l = 1, u = lay.num_owned; l < depth; l++)
+        for (int i = 0; i < ghost_rows[l].num_rows; i++, u++)
+            loc.row_ptr[u + 1] = loc.row_ptr[u] + ghost_rows[l].row_ptr[i + 1] - ghost_rows[l].row_ptr[i];
+    loc.num_cols = loc.row_ptr[loc.num_rows];
+    loc.col_idx = malloc(sizeof(int) * (loc.num_cols + 1));
+    loc.values = malloc(sizeof(double) * (loc.num_cols + 1));
+
+    for (int l = 0; l < depth; l++) {
+        CSR src = l == 0 ? *g : ghost_rows[l];
+        int first = l == 0 ? 0 : lay.num_owned + lay.level_ptr[l - 1];
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < src.num_rows; i++) {
+            int k = loc.row_ptr[first + i];
+            for (int j = src.row_ptr[i]; j < src.row_ptr[i + 1]; j++, k++) {
+                int v = src.col_idx[j];
+                if (v >= s && v < t) {
+                    loc.col_idx[k] = v - s;
+                } else {
+                    for (int m = 1; m <= depth; m++) {
+                        int pos = find_sorted(levels[m], level_size[m], v);
+                        if (pos >= 0) {
+                            loc.col_idx[k] = lay.num_owned + lay.level_ptr[m - 1] + pos;
+                            break;
+                        }
+                    }
+                }
+                loc.values[k] = src.values[j];
+            }
+        }
+    }
+
+    // Ghosts owned by r are contiguous on every level, they are requested from r in local order
+    int *scount = calloc(size, sizeof(int)), *sdispl = malloc(sizeof(int) * size);
+    int *rcount = malloc(sizeof(int) * size), *rdispl = malloc(sizeof(int) * size);
+    for (int i = 0; i < lay.num_ghosts; i++)
+        scount[owner_of(p, size, lay.ghost_gid[i])]++;
+    prefix_sum(scount, sdispl, size);
+
+    int *ids = malloc(sizeof(int) * (lay.num_ghosts + 1));
+    int *fill = malloc(sizeof(int) * size);
+    memcpy(fill, sdispl, sizeof(int) * size);
+    for (int r = 0; r < size; r++) {
+        c.receive_count[r] = scount[r];
+        c.receive_items[r] = scount[r] > 0 ? malloc(sizeof(int) * scount[r]) : NULL;
+        c.receive_lists[r] = NULL;
+    }
+    for (int i = 0; i < lay.num_ghosts; i++) {
+        int r = owner_of(p, size, lay.ghost_gid[i]);
+        c.receive_items[r][fill[r] - sdispl[r]] = lay.num_owned + i;
+        ids[fill[r]++] = lay.ghost_gid[i];
+    }
+
+    int *req = alltoall_ids(size, ids, scount, sdispl, rcount, rdispl);
+    for (int r = 0; r < size; r++) {
+        c.send_count[r] = rcount[r];
+        c.send_items[r] = rcount[r] > 0 ? malloc(sizeof(int) * rcount[r]) : NULL;
+        c.send_lists[r] = NULL;
+        for (int i = 0; i < rcount[r]; i++)
+            c.send_items[r][i] = req[rdispl[r] + i] - s;
+    }
+
+    for (int l = 1; l <= depth; l++) {
+        free(levels[l]);
+        if (l < depth)
+            free_graph(&ghost_rows[l]);
+    }
+    free(levels);
+    free(level_size);
+    free(ghost_rows);
+    free(scount);
+    free(sdispl);
+    free(rcount);
+    free(rdispl);
+    free(ids);
+    free(fill);
+    free(req);
+
+    free_graph(g);
+    *g = loc;
+    return lay;
+}
+
+void free_local_layout(local_layout *l) {
+    free(l->ghost_gid);
+    free(l->level_ptr);
+    l->ghost_gid = NULL;
+    l->level_ptr = NULL;
+    l->num_owned = 0;
+    l->num_ghosts = 0;
+    l->num_rows = 0;
+}
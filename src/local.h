@@ -0,0 +1,25 @@
+#pragma once
+#include "spmv.h"
+
+// Index space of a rank-local matrix: owned entries [0, num_owned), then the ghosts ordered
+// by (level, owner, global id). Rows are kept for the owned entries and for the ghosts less
+// than depth hops away, so they form the prefix [0, num_rows) of the index space.
+typedef struct {
+    int offset; // global id of owned entry 0
+    int num_owned, num_ghosts, num_rows;
+    int depth;
+    int *ghost_gid;
+    int *level_ptr; // ghosts of level l are num_owned + [level_ptr[l - 1], level_ptr[l])
+    long long global_nnz;
+} local_layout;
+
+CSR scatter_graph(CSR g, int *p, int rank, int size);
+
+// Rows [p[rank], p[rank + 1]) of g in the global numbering: row_ptr has all num_rows + 1
+// entries and the rows of other ranks are empty. Kernels on the own rows and full-length
+// vectors work unchanged while a rank only stores its own nonzeros.
+CSR scatter_rows(CSR g, int *p, int rank, int size);
+
+local_layout localize_graph(CSR *g, int *p, int rank, int size, int depth, comm_lists c);
+
+void free_local_layout(local_layout *l);
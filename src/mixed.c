@@ -0,0 +1,70 @@
+#include "mixed.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Round to nearest even, bf16 is the upper half of an IEEE single
+static inline uint16_t to_bf16(double v) {
+    float f = (float)v;
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    u += 0x7FFF + ((u >> 16) & 1);
+    return (uint16_t)(u >> 16);
+}
+
+static inline double from_bf16(uint16_t b) {
+    uint32_t u = (uint32_t)b << 16;
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return (double)f;
+}
+
+CSR_mixed build_mixed(CSR g, int s, int t, int precision) {
+    CSR_mixed m = {.precision = precision,
+                   .offset = g.row_ptr[s],
+                   .row_ptr = g.row_ptr,
+                   .col_idx = g.col_idx,
+                   .values_fp32 = NULL,
+                   .values_bf16 = NULL};
+    int nnz = g.row_ptr[t] - g.row_ptr[s];
+
+    if (precision == PRECISION_BF16) {
+        m.values_bf16 = malloc(sizeof(uint16_t) * (nnz + 1));
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < nnz; i++)
+            m.values_bf16[i] = to_bf16(g.values[m.offset + i]);
+    } else {
+        m.values_fp32 = malloc(sizeof(float) * (nnz + 1));
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < nnz; i++)
+            m.values_fp32[i] = (float)g.values[m.offset + i];
+    }
+
+    return m;
+}
+
+void spmv_mixed(CSR_mixed m, int s, int t, double *x, double *y) {
+    if (m.precision == PRECISION_BF16) {
+#pragma omp parallel for schedule(static)
+        for (int u = s; u < t; u++) {
+            double z = 0.0;
+            for (int i = m.row_ptr[u]; i < m.row_ptr[u + 1]; i++)
+                z += x[m.col_idx[i]] * from_bf16(m.values_bf16[i - m.offset]);
+            y[u] = z;
+        }
+    } else {
+#pragma omp parallel for schedule(static)
+        for (int u = s; u < t; u++) {
+            double z = 0.0;
+            for (int i = m.row_ptr[u]; i < m.row_ptr[u + 1]; i++)
+                z += x[m.col_idx[i]] * (double)m.values_fp32[i - m.offset];
+            y[u] = z;
+        }
+    }
+}
+
+void free_mixed(CSR_mixed *m) {
+    free(m->values_fp32);
+    free(m->values_bf16);
+    m->values_fp32 = NULL;
+    m->values_bf16 = NULL;
+}
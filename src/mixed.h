@@ -0,0 +1,20 @@
+#pragma once
+#include "mtx.h"
+#include <stdint.h>
+
+typedef enum { PRECISION_FP32, PRECISION_BF16 } value_precision;
+
+// Rows [s, t) of a CSR matrix with the values stored in reduced precision. The structure
+// is shared with the double matrix, products are still accumulated in double.
+typedef struct {
+    int precision, offset;
+    int *row_ptr, *col_idx;
+    float *values_fp32;
+    uint16_t *values_bf16;
+} CSR_mixed;
+
+CSR_mixed build_mixed(CSR g, int s, int t, int precision);
+
+void spmv_mixed(CSR_mixed m, int s, int t, double *x, double *y);
+
+void free_mixed(CSR_mixed *m);
@@ -1,238 +1,272 @@
 #include "mtx.h"
+#include "csrcache.h"
+#include "generate.h"
+#include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <omp.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 
-#define GENERAL 0
-#define SYMMETRIC 1
+// Every parser below stops at end, the mapped file is not NUL terminated
 
-typedef struct {
-    int symmetry;
-    int M, N, L;
-    int *I, *J;
-    double *A;
-} mtx;
-
-static inline void parse_int(char *data, size_t *p, int *v) {
-    while (data[*p] == ' ')
-        (*p)++;
+static inline const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
 
-    *v = 0;
+static inline const char *next_line(const char *p, const char *end) {
+    const char *nl = memchr(p, '\n', end - p);
+    return nl != NULL ? nl + 1 : end;
+}
 
+static inline const char *parse_int(const char *p, const char *end, int *v) {
+    p = skip_blanks(p, end);
     int sign = 1;
-    if (data[*p] == '-') {
-        sign = -1;
-        (*p)++;
-    }
-
-    while (data[*p] >= '0' && data[*p] <= '9') {
-        *v = (*v) * 10 + data[*p] - '0';
-        (*p)++;
-    }
-
-    *v *= sign;
+    if (p < end && (*p == '-' || *p == '+'))
+        sign = *p++ == '-' ? -1 : 1;
+    if (p == end || *p < '0' || *p > '9')
+        return NULL;
+
+    long long r = 0;
+    while (p < end && *p >= '0' && *p <= '9' && r <= 0x7fffffff)
+        r = r * 10 + (*p++ - '0');
+    if (r > 0x7fffffff)
+        return NULL;
+    *v = (int)(sign * r);
+    return p;
 }
 
-static inline void parse_real(char *data, size_t *p, double *v) {
-    while (data[*p] == ' ')
-        (*p)++;
-
-    *v = 0.0;
-
-    double sign = 1.0;
-    if (data[*p] == '-') {
-        sign = -1.0;
-        (*p)++;
-    }
-
-    while (data[*p] >= '0' && data[*p] <= '9') {
-        *v = (*v) * 10.0 + (double)(data[*p] - '0');
-        (*p)++;
+static const double exact_powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Clinger's fast path: a mantissa below 2^53 times an exactly representable power of ten is
+// correctly rounded by one IEEE multiply or divide. Everything else goes through strtod.
+static inline const char *parse_real(const char *p, const char *end, double *v) {
+    p = skip_blanks(p, end);
+    const char *start = p;
+
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0, exp10 = 0, any = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa > 0;
+        } else {
+            exp10++;
+        }
+        any = 1;
+        p++;
     }
-
-    if (data[*p] == '.') {
-        (*p)++;
-        double s = 0.1;
-        while (data[*p] >= '0' && data[*p] <= '9') {
-            *v += (double)(data[*p] - '0') * s;
-            (*p)++;
-            s *= 0.1;
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa > 0;
+                exp10--;
+            }
+            any = 1;
+            p++;
         }
     }
-    *v *= sign;
+    if (any && p < end && (*p == 'e' || *p == 'E')) {
+        int e;
+        const char *q = parse_int(p + 1, end, &e);
+        if (q == NULL)
+            return NULL;
+        exp10 += e;
+        p = q;
+    }
 
-    if (data[*p] == 'e') {
-        (*p)++;
-        int m;
-        parse_int(data, p, &m);
-        *v *= pow(10.0, m);
+    if (any && (p == end || *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') && mantissa < (1ull << 53) &&
+        exp10 >= -22 && exp10 <= 22) {
+        double r = (double)mantissa;
+        r = exp10 < 0 ? r / exact_powers[-exp10] : r * exact_powers[exp10];
+        *v = negative ? -r : r;
+        return p;
     }
-}
 
-static inline void skip_line(char *data, size_t *p) {
-    while (data[*p] != '\n')
-        (*p)++;
-    (*p)++;
+    // Long mantissas, large exponents, inf and nan
+    char buffer[128];
+    size_t n = 0;
+    p = start;
+    while (p < end && n < sizeof(buffer) - 1 && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+        buffer[n++] = *p++;
+    buffer[n] = '\0';
+    char *stop;
+    *v = strtod(buffer, &stop);
+    return stop == buffer ? NULL : p;
 }
 
-static inline void skip_line_safe(char *data, size_t *p, size_t t) {
-    while (*p < t && data[*p] != '\n')
-        (*p)++;
-    (*p)++;
+static int lower_equal(const char *a, const char *b) {
+    for (; *a && *b; a++, b++)
+        if ((*a | 0x20) != (*b | 0x20))
+            return 0;
+    return *a == *b;
 }
 
-mtx internal_parse_mtx_header(char *data, size_t *p) {
-    mtx m;
-
+static const char *parse_banner(const char *data, const char *end, mtx *m) {
     char header[256];
-    while (*p < 255 && data[*p] != '\n') {
-        header[*p] = data[*p];
-        (*p)++;
-    }
-    header[*p] = '\0';
-    (*p)++;
-
-    if (*p == 256) {
+    const char *eol = next_line(data, end);
+    size_t n = eol - data < (long)sizeof(header) ? eol - data : sizeof(header) - 1;
+    memcpy(header, data, n);
+    header[n] = '\0';
+
+    char *save, *token[5];
+    token[0] = strtok_r(header, " \t\r\n", &save);
+    for (int i = 1; i < 5; i++)
+        token[i] = token[i - 1] != NULL ? strtok_r(NULL, " \t\r\n", &save) : NULL;
+
+    if (token[4] == NULL || !lower_equal(token[0], "%%MatrixMarket") || !lower_equal(token[1], "matrix") ||
+        !lower_equal(token[2], "coordinate")) {
         fprintf(stderr, "Invalid header %s\n", header);
-        exit(1);
+        return NULL;
     }
 
-    char *token = strtok(header, " ");
-    token = strtok(NULL, " ");
-    token = strtok(NULL, " ");
-    token = strtok(NULL, " ");
-    token = strtok(NULL, " ");
+    if (lower_equal(token[3], "real") || lower_equal(token[3], "double"))
+        m->field = FIELD_REAL;
+    else if (lower_equal(token[3], "integer"))
+        m->field = FIELD_INTEGER;
+    else if (lower_equal(token[3], "pattern"))
+        m->field = FIELD_PATTERN;
+    else {
+        fprintf(stderr, "Unsupported field %s\n", token[3]);
+        return NULL;
+    }
 
-    if (strcmp(token, "general") == 0)
-        m.symmetry = GENERAL;
-    else if (strcmp(token, "symmetric") == 0)
-        m.symmetry = SYMMETRIC;
+    if (lower_equal(token[4], "general"))
+        m->symmetry = GENERAL;
+    else if (lower_equal(token[4], "symmetric"))
+        m->symmetry = SYMMETRIC;
+    else if (lower_equal(token[4], "skew-symmetric"))
+        m->symmetry = SKEW_SYMMETRIC;
     else {
-        fprintf(stderr, "Invalid symmetry %s\n", token);
-        exit(1);
+        fprintf(stderr, "Invalid symmetry %s\n", token[4]);
+        return NULL;
     }
 
-    return m;
+    return eol;
 }
 
-mtx internal_parse_mtx(FILE *f) {
-    fseek(f, 0, SEEK_END);
-    size_t size = ftell(f);
-    fseek(f, 0, SEEK_SET);
-
-    char *data = (char *)mmap(0, size, PROT_READ, MAP_SHARED, fileno_unlocked(f), 0);
-    size_t p = 0;
-
-    mtx m = internal_parse_mtx_header(data, &p);
-
-    while (data[p] == '%')
-        skip_line_safe(data, &p, size);
+// Blank lines and comments carry no entry, they may appear anywhere after the header
+static inline int is_data_line(const char *p, const char *end) {
+    p = skip_blanks(p, end);
+    return p < end && *p != '%' && *p != '\n' && *p != '\r';
+}
 
-    parse_int(data, &p, &m.M);
-    parse_int(data, &p, &m.N);
-    parse_int(data, &p, &m.L);
+// Start of the first line beginning at or after p
+static const char *align_to_line(const char *p, const char *begin, const char *end) {
+    if (p <= begin || p[-1] == '\n')
+        return p;
+    return next_line(p, end);
+}
 
-    m.I = (int *)malloc(sizeof(int) * m.L);
-    m.J = (int *)malloc(sizeof(int) * m.L);
-    m.A = (double *)malloc(sizeof(double) * m.L);
+const char *parse_mtx_header(const char *data, const char *end, mtx *m) {
+    const char *p = parse_banner(data, end, m);
+    if (p == NULL)
+        return NULL;
+    while (p < end && !is_data_line(p, end))
+        p = next_line(p, end);
+
+    p = parse_int(p, end, &m->M);
+    p = p != NULL ? parse_int(p, end, &m->N) : NULL;
+    p = p != NULL ? parse_int(p, end, &m->L) : NULL;
+    if (p == NULL || m->M < 0 || m->N < 0 || m->L < 0) {
+        fprintf(stderr, "Invalid size line\n");
+        return NULL;
+    }
+    return next_line(p, end);
+}
 
-    int *tc;
+// Each thread owns the lines that start in its byte range. It counts its entries, then
+// parses them into the slots given by the prefix sum of the counts.
+int parse_mtx_entries(const char *s, const char *t, const char *end, mtx *m) {
+    int nt = omp_get_max_threads();
+    long long *count = calloc(nt + 1, sizeof(long long));
+    int errors = 0;
 
-#pragma omp parallel shared(tc) firstprivate(p, size, data, m)
+#pragma omp parallel num_threads(nt) reduction(+ : errors)
     {
         int tid = omp_get_thread_num();
-        int nt = omp_get_num_threads();
+        size_t chunk = (size_t)(t - s) / nt;
+        const char *a = align_to_line(s + chunk * tid, s, end);
+        const char *b = tid == nt - 1 ? t : align_to_line(s + chunk * (tid + 1), s, end);
 
-        size_t s = ((size - p) / nt) * tid + p;
-        size_t t = s + (size - p) / nt;
-        if (tid == nt - 1)
-            t = size;
-
-        if (tid == 0)
-            tc = (int *)malloc(sizeof(int) * nt);
+        long long lines = 0;
+        for (const char *q = a; q < b; q = next_line(q, end))
+            lines += is_data_line(q, end);
+        count[tid + 1] = lines;
 
 #pragma omp barrier
-
-        int lc = 0;
-        for (size_t i = s; i < t; i++)
-            if (data[i] == '\n')
-                lc++;
-        tc[tid] = lc;
-
-#pragma omp barrier
-
-        p = s;
-        s = 0;
-        for (int i = 0; i < tid; i++)
-            s += tc[i];
-
-        t = s + tc[tid];
-        if (tid == nt - 1 || t > m.L)
-            t = m.L;
-
-        for (int i = s; i < t; i++) {
-            skip_line_safe(data, &p, size);
-
-            parse_int(data, &p, m.I + i);
-            parse_int(data, &p, m.J + i);
-            parse_real(data, &p, m.A + i);
+#pragma omp single
+        {
+            for (int i = 0; i < nt; i++)
+                count[i + 1] += count[i];
+            m->I = (int *)malloc(sizeof(int) * ((size_t)count[nt] + 1));
+            m->J = (int *)malloc(sizeof(int) * ((size_t)count[nt] + 1));
+            m->A = (double *)malloc(sizeof(double) * ((size_t)count[nt] + 1));
         }
 
-#pragma omp barrier
-
-        if (tid == 0)
-            free(tc);
+        long long k = count[tid];
+        for (const char *q = a; q < b; q = next_line(q, end)) {
+            if (!is_data_line(q, end))
+                continue;
+
+            const char *r = parse_int(q, end, m->I + k);
+            r = r != NULL ? parse_int(r, end, m->J + k) : NULL;
+            if (r != NULL && m->field != FIELD_PATTERN)
+                r = parse_real(r, end, m->A + k);
+            else
+                m->A[k] = 1.0;
+
+            if (r == NULL || m->I[k] < 1 || m->I[k] > m->M || m->J[k] < 1 || m->J[k] > m->N)
+                errors++;
+            k++;
+        }
     }
 
-    // for (int i = 0; i < m.L; i++)
-    // {
-    //     skip_line(data, &p);
-
-    //     while (data[p] == '%')
-    //         skip_line(data, &p);
-
-    //     parse_int(data, &p, m.I + i);
-    //     parse_int(data, &p, m.J + i);
-    //     parse_real(data, &p, m.A + i);
-    // }
-
-    munmap(data, size);
-
-    return m;
+    m->L = count[nt] <= INT_MAX ? (int)count[nt] : -1;
+    free(count);
+    return errors;
 }
 
-mtx internal_parse_mtx_seq(FILE *f) {
-    char *line = NULL;
-    size_t size = 0, rc = 0, p = 0;
-    rc = getline(&line, &size, f);
-    mtx m = internal_parse_mtx_header(line, &p);
-    rc = getline(&line, &size, f);
-
-    while (line[0] == '%')
-        rc = getline(&line, &size, f);
-
-    p = 0;
-    parse_int(line, &p, &m.M);
-    parse_int(line, &p, &m.N);
-    parse_int(line, &p, &m.L);
+static mtx internal_parse_mtx(FILE *f) {
+    fseek(f, 0, SEEK_END);
+    size_t size = ftell(f);
+    fseek(f, 0, SEEK_SET);
 
-    m.I = (int *)malloc(sizeof(int) * m.L);
-    m.J = (int *)malloc(sizeof(int) * m.L);
-    m.A = (double *)malloc(sizeof(double) * m.L);
+    double t0 = omp_get_wtime();
+    char *data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0) : MAP_FAILED;
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Could not map the matrix file\n");
+        exit(1);
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+    const char *end = data + size;
 
-    for (int i = 0; i < m.L; i++) {
-        rc = getline(&line, &size, f);
-        p = 0;
+    mtx m;
+    const char *body = parse_mtx_header(data, end, &m);
+    if (body == NULL)
+        exit(1);
+    int expected = m.L;
+    int errors = parse_mtx_entries(body, end, end, &m);
 
-        parse_int(line, &p, m.I + i);
-        parse_int(line, &p, m.J + i);
-        parse_real(line, &p, m.A + i);
+    if (errors > 0 || m.L != expected) {
+        fprintf(stderr, "Invalid matrix entries: %d lines for %d entries, %d malformed\n", m.L, expected, errors);
+        exit(1);
     }
 
-    free(line);
-    printf("Done parsing mtx\n");
+    double t1 = omp_get_wtime();
+    munmap(data, size);
+
+    printf("Done parsing mtx, %.1f MB in %.3fs (%.2f GB/s)\n", size / 1e6, t1 - t0, size / ((t1 - t0) * 1e9));
     fflush(stdout);
 
     return m;
@@ -251,78 +285,251 @@ void internal_free_mtx(mtx *m) {
     m->A = NULL;
 }
 
-CSR parse_mtx(FILE *f) {
-    mtx m = internal_parse_mtx_seq(f);
-    printf("%d, %d, %d\n", m.M, m.N, m.L);
+#define BUCKETS_PER_THREAD 8
+#define INSERTION_SORT_MAX 16
+
+// Stable sort of n (col, val) pairs by column, insertion sorted runs merged bottom-up
+static void sort_row(int *col, double *val, int n, int *col_tmp, double *val_tmp) {
+    for (int s = 0; s < n; s += INSERTION_SORT_MAX) {
+        int t = s + INSERTION_SORT_MAX < n ? s + INSERTION_SORT_MAX : n;
+        for (int i = s + 1; i < t; i++) {
+            int c = col[i];
+            double v = val[i];
+            int j = i - 1;
+            for (; j >= s && col[j] > c; j--) {
+                col[j + 1] = col[j];
+                val[j + 1] = val[j];
+            }
+            col[j + 1] = c;
+            val[j + 1] = v;
+        }
+    }
+
+    int *src_col = col, *dst_col = col_tmp;
+    double *src_val = val, *dst_val = val_tmp;
+    for (int w = INSERTION_SORT_MAX; w < n; w *= 2) {
+        for (int lo = 0; lo < n; lo += 2 * w) {
+            int mid = lo + w < n ? lo + w : n, hi = lo + 2 * w < n ? lo + 2 * w : n;
+            int i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                // Ties take the left run first, which keeps the input order
+                if (src_col[j] < src_col[i]) {
+                    dst_col[k] = src_col[j];
+                    dst_val[k++] = src_val[j++];
+                } else {
+                    dst_col[k] = src_col[i];
+                    dst_val[k++] = src_val[i++];
+                }
+            }
+            for (; i < mid; i++, k++) {
+                dst_col[k] = src_col[i];
+                dst_val[k] = src_val[i];
+            }
+            for (; j < hi; j++, k++) {
+                dst_col[k] = src_col[j];
+                dst_val[k] = src_val[j];
+            }
+        }
+        int *tc = src_col;
+        src_col = dst_col;
+        dst_col = tc;
+        double *tv = src_val;
+        src_val = dst_val;
+        dst_val = tv;
+    }
+
+    if (src_col != col) {
+        memcpy(col, src_col, sizeof(int) * n);
+        memcpy(val, src_val, sizeof(double) * n);
+    }
+}
 
+// Entries are first scattered into contiguous row buckets by a stable parallel counting
+// sort, then every bucket is sorted by row and by column on its own. Both sorts are stable,
+// so duplicates are summed in file order and the result does not depend on the thread count.
+CSR coo_to_csr(mtx *m, int num_rows) {
     CSR g;
-    g.num_rows = m.N > m.M ? m.N : m.M;
-    g.row_ptr = (int *)calloc(g.num_rows + 1, sizeof(int));
+    g.num_rows = num_rows;
+    int n = g.num_rows, mirror = m->symmetry != GENERAL;
+
+    int nt = omp_get_max_threads();
+    int rows_per_bucket = (n + nt * BUCKETS_PER_THREAD - 1) / (nt * BUCKETS_PER_THREAD);
+    if (rows_per_bucket < 1)
+        rows_per_bucket = 1;
+    int nb = (n + rows_per_bucket - 1) / rows_per_bucket;
+    if (nb < 1)
+        nb = 1;
+
+    size_t *count = calloc((size_t)nt * nb, sizeof(size_t));
+    size_t *bucket_ptr = malloc(sizeof(size_t) * (nb + 1));
+    int *row_of = NULL;
+
+#pragma omp parallel num_threads(nt)
+    {
+        int tid = omp_get_thread_num();
+        int a = (int)((long long)m->L * tid / nt), b = (int)((long long)m->L * (tid + 1) / nt);
+        size_t *c = count + (size_t)tid * nb;
 
-    // Count degree
+        for (int i = a; i < b; i++) {
+            c[(m->I[i] - 1) / rows_per_bucket]++;
+            if (mirror && m->I[i] != m->J[i])
+                c[(m->J[i] - 1) / rows_per_bucket]++;
+        }
 
-#pragma omp parallel for
-    for (int i = 0; i < m.L; i++) {
-        __atomic_add_fetch(g.row_ptr + (m.I[i] - 1), 1, __ATOMIC_RELAXED);
+#pragma omp barrier
+#pragma omp single
+        {
+            // Bucket major, thread minor: every bucket keeps the entries in file order
+            size_t pos = 0;
+            for (int bk = 0; bk < nb; bk++) {
+                bucket_ptr[bk] = pos;
+                for (int t = 0; t < nt; t++) {
+                    size_t k = count[(size_t)t * nb + bk];
+                    count[(size_t)t * nb + bk] = pos;
+                    pos += k;
+                }
+            }
+            bucket_ptr[nb] = pos;
 
-        if (m.I[i] != m.J[i] && m.symmetry == SYMMETRIC)
-            __atomic_add_fetch(g.row_ptr + (m.J[i] - 1), 1, __ATOMIC_RELAXED);
+            g.num_cols = (int)pos;
+            g.col_idx = (int *)malloc(sizeof(int) * (pos + 1));
+            g.values = (double *)malloc(sizeof(double) * (pos + 1));
+            row_of = (int *)malloc(sizeof(int) * (pos + 1));
+        }
 
-        // g.V[m.I[i] - 1]++;
-        // if (m.I[i] != m.J[i] && m.symmetry == SYMMETRIC)
-        //     g.V[m.J[i] - 1]++;
+        for (int i = a; i < b; i++) {
+            size_t k = c[(m->I[i] - 1) / rows_per_bucket]++;
+            row_of[k] = m->I[i] - 1;
+            g.col_idx[k] = m->J[i] - 1;
+            g.values[k] = m->A[i];
+
+            // Skew-symmetric files store the strict lower triangle, the mirror is negated
+            if (mirror && m->I[i] != m->J[i]) {
+                k = c[(m->J[i] - 1) / rows_per_bucket]++;
+                row_of[k] = m->J[i] - 1;
+                g.col_idx[k] = m->I[i] - 1;
+                g.values[k] = m->symmetry == SKEW_SYMMETRIC ? -m->A[i] : m->A[i];
+            }
+        }
     }
 
-    for (int i = 1; i <= g.num_rows; i++) {
-        g.row_ptr[i] += g.row_ptr[i - 1];
-    }
+    internal_free_mtx(m);
+    free(count);
+
+    g.row_ptr = (int *)calloc(n + 1, sizeof(int));
+    size_t *bucket_nnz = malloc(sizeof(size_t) * nb);
 
-    g.num_cols = g.row_ptr[g.num_rows];
-    g.col_idx = (int *)malloc(sizeof(int) * g.num_cols);
-    g.values = (double *)malloc(sizeof(double) * g.num_cols);
+#pragma omp parallel num_threads(nt)
+    {
+        size_t cap = 0;
+        int *col_a = NULL, *col_b = NULL, *cursor = malloc(sizeof(int) * (rows_per_bucket + 1));
+        double *val_a = NULL, *val_b = NULL;
+
+#pragma omp for schedule(dynamic)
+        for (int bk = 0; bk < nb; bk++) {
+            size_t s = bucket_ptr[bk], len = bucket_ptr[bk + 1] - s;
+            int r0 = bk * rows_per_bucket, r1 = r0 + rows_per_bucket < n ? r0 + rows_per_bucket : n;
+            if (len > cap) {
+                cap = len;
+                col_a = realloc(col_a, sizeof(int) * cap);
+                col_b = realloc(col_b, sizeof(int) * cap);
+                val_a = realloc(val_a, sizeof(double) * cap);
+                val_b = realloc(val_b, sizeof(double) * cap);
+            }
 
-#pragma omp parallel for
-    for (int i = 0; i < m.L; i++) {
-        int j = __atomic_sub_fetch(g.row_ptr + (m.I[i] - 1), 1, __ATOMIC_RELAXED);
-        g.col_idx[j] = m.J[i] - 1;
-        g.values[j] = m.A[i];
+            // Counting sort by row, row_ptr[r + 1] counts row r until the final prefix sum
+            for (size_t k = s; k < s + len; k++)
+                g.row_ptr[row_of[k] + 1]++;
+            int pos = 0;
+            for (int r = r0; r < r1; r++) {
+                cursor[r - r0] = pos;
+                pos += g.row_ptr[r + 1];
+            }
+            for (size_t k = s; k < s + len; k++) {
+                int j = cursor[row_of[k] - r0]++;
+                col_a[j] = g.col_idx[k];
+                val_a[j] = g.values[k];
+            }
 
-        if (m.I[i] != m.J[i] && m.symmetry == SYMMETRIC) {
-            j = __atomic_sub_fetch(g.row_ptr + (m.J[i] - 1), 1, __ATOMIC_RELAXED);
-            g.col_idx[j] = m.I[i] - 1;
-            g.values[j] = m.A[i];
+            // Sort every row by column and sum duplicates, writing back compacted from s
+            size_t w = s;
+            for (int r = r0, lo = 0; r < r1; r++) {
+                int d = g.row_ptr[r + 1];
+                sort_row(col_a + lo, val_a + lo, d, col_b, val_b);
+                int kept = 0;
+                for (int i = lo; i < lo + d; i++) {
+                    if (kept > 0 && g.col_idx[w - 1] == col_a[i]) {
+                        g.values[w - 1] += val_a[i];
+                    } else {
+                        g.col_idx[w] = col_a[i];
+                        g.values[w++] = val_a[i];
+                        kept++;
+                    }
+                }
+                g.row_ptr[r + 1] = kept;
+                lo += d;
+            }
+            bucket_nnz[bk] = w - s;
         }
 
-        // g.V[m.I[i] - 1]--;
-        // g.E[g.V[m.I[i] - 1]] = m.J[i] - 1;
-        // g.A[g.V[m.I[i] - 1]] = m.A[i];
+        free(col_a);
+        free(col_b);
+        free(val_a);
+        free(val_b);
+        free(cursor);
+    }
 
-        // if (m.I[i] != m.J[i] && m.symmetry == SYMMETRIC)
-        // {
-        //     g.V[m.J[i] - 1]--;
-        //     g.E[g.V[m.J[i] - 1]] = m.I[i] - 1;
-        //     g.A[g.V[m.J[i] - 1]] = m.A[i];
-        // }
+    // Duplicates leave gaps at the end of buckets, close them in order
+    size_t w = 0;
+    for (int bk = 0; bk < nb; bk++) {
+        if (w != bucket_ptr[bk]) {
+            memmove(g.col_idx + w, g.col_idx + bucket_ptr[bk], sizeof(int) * bucket_nnz[bk]);
+            memmove(g.values + w, g.values + bucket_ptr[bk], sizeof(double) * bucket_nnz[bk]);
+        }
+        w += bucket_nnz[bk];
     }
+    if (w != (size_t)g.num_cols)
+        printf("Summed %zu duplicate entries\n", (size_t)g.num_cols - w);
+    g.num_cols = (int)w;
 
-    internal_free_mtx(&m);
+    for (int i = 1; i <= n; i++)
+        g.row_ptr[i] += g.row_ptr[i - 1];
 
+    free(row_of);
+    free(bucket_ptr);
+    free(bucket_nnz);
     return g;
 }
 
+CSR parse_mtx(FILE *f) {
+    mtx m = internal_parse_mtx(f);
+    printf("%d, %d, %d\n", m.M, m.N, m.L);
+    return coo_to_csr(&m, m.N > m.M ? m.N : m.M);
+}
+
 CSR parse_and_validate_mtx(const char *path) {
+    if (is_generated(path))
+        return generate_graph(path);
+
+    CSR g;
+    if (load_csr_cache(path, &g) == 0) {
+        printf("Loaded binary cache %s.csr\n", path);
+        printf("|V|=%d |E|=%d\n", g.num_rows, g.num_cols);
+        return g;
+    }
+
     FILE *f = fopen(path, "r");
-    CSR g = parse_mtx(f);
+    g = parse_mtx(f);
     fclose(f);
 
     printf("|V|=%d |E|=%d\n", g.num_rows, g.num_cols);
 
     printf("Normalizing graph\n");
     normalize_graph(g);
-    printf("Sorting edges\n");
-    sort_edges(g);
     if (!validate_graph(g))
         printf("Error in graph\n");
+    else if (save_csr_cache(path, g) != 0)
+        printf("Could not write binary cache %s.csr\n", path);
 
     return g;
 }
@@ -330,49 +537,23 @@ CSR parse_and_validate_mtx(const char *path) {
 void free_graph(CSR *g) {
     g->num_rows = 0;
     g->num_cols = 0;
-    free(g->values);
-    free(g->row_ptr);
-    free(g->col_idx);
+    if (!release_csr_cache(g)) {
+        free(g->values);
+        free(g->row_ptr);
+        free(g->col_idx);
+    }
     g->values = NULL;
     g->row_ptr = NULL;
     g->col_idx = NULL;
 }
 
-int compare(const void *a, const void *b, void *c) {
-    int ia = *(int *)a, ib = *(int *)b;
-    int *data = (int *)c;
-
-    return data[ia] - data[ib];
-}
-
-void sort_edges(CSR g) {
-#pragma omp parallel
-    {
-        int *index = (int *)malloc(sizeof(int) * g.num_rows);
-        int *E_buffer = (int *)malloc(sizeof(int) * g.num_rows);
-        double *A_buffer = (double *)malloc(sizeof(double) * g.num_rows);
-
-#pragma omp for
-        for (int u = 0; u < g.num_rows; u++) {
-            int degree = g.row_ptr[u + 1] - g.row_ptr[u];
-
-            for (int i = 0; i < degree; i++)
-                index[i] = i;
-
-            qsort_r(index, degree, sizeof(int), compare, g.col_idx + g.row_ptr[u]);
-            for (int i = 0; i < degree; i++) {
-                E_buffer[i] = g.col_idx[g.row_ptr[u] + index[i]];
-                A_buffer[i] = g.values[g.row_ptr[u] + index[i]];
-            }
-
-            memcpy(g.col_idx + g.row_ptr[u], E_buffer, degree * sizeof(int));
-            memcpy(g.values + g.row_ptr[u], A_buffer, degree * sizeof(double));
-        }
-
-        free(index);
-        free(E_buffer);
-        free(A_buffer);
+void free_graph_entries(CSR *g) {
+    if (!release_csr_cache_entries(g)) {
+        free(g->values);
+        free(g->col_idx);
     }
+    g->values = NULL;
+    g->col_idx = NULL;
 }
 
 int cmpfunc(const void *a, const void *b) { return (*(double *)a - *(double *)b); }
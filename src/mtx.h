@@ -7,14 +7,45 @@ typedef struct {
     double *values;
 } CSR;
 
+#define GENERAL 0
+#define SYMMETRIC 1
+#define SKEW_SYMMETRIC 2
+
+#define FIELD_REAL 0
+#define FIELD_INTEGER 1
+#define FIELD_PATTERN 2
+
+// Coordinate entries as they appear in a MatrixMarket file, indices are 1-based
+typedef struct {
+    int symmetry, field;
+    int M, N, L;
+    int *I, *J;
+    double *A;
+} mtx;
+
 int cmpfunc(const void *a, const void *b);
 CSR parse_and_validate_mtx(const char *path);
 
 CSR parse_mtx(FILE *f);
 
+// Reads the banner and the size line of data, returns the start of the line after the size line,
+// or NULL after reporting an invalid header
+const char *parse_mtx_header(const char *data, const char *end, mtx *m);
+
+// Parses the entries on the lines starting in [s, t) into freshly allocated I, J and A and
+// sets L to their number. s must start a line, the last line may run on up to end. Returns
+// the number of malformed entries.
+int parse_mtx_entries(const char *s, const char *t, const char *end, mtx *m);
+
+// Rows 1..num_rows of the entries, symmetric files are mirrored. Frees the entries.
+CSR coo_to_csr(mtx *m, int num_rows);
+
+void internal_free_mtx(mtx *m);
+
 void free_graph(CSR *g);
 
-void sort_edges(CSR g);
+// Frees col_idx and values of g, row_ptr and the sizes stay for code that only needs row bounds
+void free_graph_entries(CSR *g);
 
 void normalize_graph(CSR g);
 
@@ -0,0 +1,300 @@
+#include "options.h"
+#include "generate.h"
+#include "kernel.h"
+#include <getopt.h>
+#include <mpi.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The per-strategy binaries are this driver with another default
+#ifndef DEFAULT_STRATEGY
+#define DEFAULT_STRATEGY "D"
+#endif
+
+options options_default(void) {
+    options opt = {.path = NULL,
+                   .strategy = DEFAULT_STRATEGY,
+                   .iters = 100,
+                   .warmup = 10,
+                   .repeat = 1,
+                   .output = OUTPUT_TEXT,
+                   .results = NULL,
+                   .stream_mb = 1024,
+                   .counters = 0,
+                   .format = FORMAT_CSR,
+                   .schedule = SCHEDULE_STATIC,
+                   .num_vectors = 1,
+                   .steps = 1,
+                   .overlap = 0,
+                   .ingest = 0,
+#if defined(__AVX512F__)
+                   .sell_c = 8,
+#else
+                   .sell_c = 4,
+#endif
+                   .sell_sigma = 256,
+                   .block_r = 0,
+                   .block_c = 0,
+                   .part = {.order = ORDER_NONE,
+                            .weights = WEIGHTS_ROWS,
+                            .objective = OBJECTIVE_CUT,
+                            .block_size = 1}};
+    return opt;
+}
+
+static void usage(const char *prog) {
+    options def = options_default();
+    fprintf(stderr,
+            "Usage: %s [options] <matrix.mtx|gen:kind[:key=value,...]>\n"
+            "  gen:stencil5|stencil7|stencil27|banded|fem|rmat\n"
+            "                                generated matrix instead of a file, keys: rows or\n"
+            "                                rank_rows (per rank, for weak scaling), seed, bw\n"
+            "                                (banded), dof (fem), deg, a, b, c (rmat)\n"
+            "  -t, --strategy <seq|A|B|C|D>  distribution: sequential, allgather, separator\n"
+            "                                allgather, pairwise separators or halo (default %s)\n"
+            "  -n, --iters <n>               timed products per run (default %d)\n"
+            "  -W, --warmup <n>              untimed products before the first run (default %d)\n"
+            "  -r, --repeat <n>              timed runs, reported as median and percentiles\n"
+            "                                (default %d)\n"
+            "  -F, --output <text|json|csv>  result format, json and csv list every run\n"
+            "                                (default text)\n"
+            "  -R, --results <file>          append json or csv results to file instead of stdout\n"
+            "  -T, --stream <MB>             memory of the STREAM triad that measures the peak\n"
+            "                                bandwidth, per node, 0 skips it (default %d)\n"
+            "  -P, --counters                count cycles, instructions, LLC and dTLB misses and\n"
+            "                                stall cycles of every phase with perf_event_open\n"
+            "  -f, --format <fmt>            storage format of the local matrix: csr, sell, bcsr,\n"
+            "                                fp32, bf16 or sym (default csr). sym stores about\n"
+            "                                half the matrix, the csr entries are only kept with\n"
+            "                                --overlap or --sstep\n"
+            "  -S, --schedule <static|nnz|merge>\n"
+            "                                thread decomposition of the CSR rows (default static)\n"
+            "  -k, --vectors <k>             number of vectors multiplied at once, csr with the\n"
+            "                                static schedule only (default 1)\n"
+            "  -p, --sstep <s>               products per halo exchange, strategy D only (default 1)\n"
+            "  -o, --overlap                 overlap the halo exchange with the interior rows,\n"
+            "                                strategies B, C and D, not with --ingest\n"
+            "  -i, --ingest                  every rank reads its own slice of the input and keeps\n"
+            "                                contiguous nnz-balanced rows without METIS, strategy D\n"
+            "                                only, not with --format bcsr\n"
+            "  -H, --hierarchical            partition over the nodes first, then over the ranks\n"
+            "                                of every node\n"
+            "  -w, --weights <rows|nnz|nnz+sep>\n"
+            "                                METIS vertex weights, nnz+sep also balances the\n"
+            "                                separator rows (default rows)\n"
+            "  -E, --edge-weights            METIS edges weigh 2 where both a_ij and a_ji are\n"
+            "                                stored, 1 otherwise (default unit weights)\n"
+            "  -J, --objective <cut|vol>     METIS objective: edge cut or communication volume\n"
+            "                                (default cut)\n"
+            "  -O, --order <none|rcm|degree|bfs>\n"
+            "                                row order inside every part: reverse Cuthill-McKee,\n"
+            "                                degree, or BFS from the separators (default none)\n"
+            "  -C, --chunk <C>               SELL chunk height (default %d)\n"
+            "  -s, --sigma <sigma>           SELL sorting window (default %d)\n"
+            "  -b, --block <auto|B|RxC>      BCSR block size (default auto)\n",
+            prog, def.strategy, def.iters, def.warmup, def.repeat, def.stream_mb, def.sell_c, def.sell_sigma);
+}
+
+// Every rank parses the same arguments and fails the same way, only rank 0 reports it
+static void reject(int rank, const char *prog, const char *fmt, ...) {
+    if (rank == 0 && fmt != NULL) {
+        va_list args;
+        va_start(args, fmt);
+        vfprintf(stderr, fmt, args);
+        va_end(args);
+    }
+    if (rank == 0 && prog != NULL)
+        usage(prog);
+    MPI_Finalize();
+    exit(1);
+}
+
+options parse_options(int argc, char **argv, int rank) {
+    options opt = options_default();
+    opterr = rank == 0;
+
+    static struct option long_options[] = {{"strategy", required_argument, 0, 't'},
+                                           {"iters", required_argument, 0, 'n'},
+                                           {"warmup", required_argument, 0, 'W'},
+                                           {"repeat", required_argument, 0, 'r'},
+                                           {"output", required_argument, 0, 'F'},
+                                           {"results", required_argument, 0, 'R'},
+                                           {"stream", required_argument, 0, 'T'},
+                                           {"counters", no_argument, 0, 'P'},
+                                           {"format", required_argument, 0, 'f'},
+                                           {"schedule", required_argument, 0, 'S'},
+                                           {"vectors", required_argument, 0, 'k'},
+                                           {"sstep", required_argument, 0, 'p'},
+                                           {"overlap", no_argument, 0, 'o'},
+                                           {"ingest", no_argument, 0, 'i'},
+                                           {"hierarchical", no_argument, 0, 'H'},
+                                           {"weights", required_argument, 0, 'w'},
+                                           {"edge-weights", no_argument, 0, 'E'},
+                                           {"objective", required_argument, 0, 'J'},
+                                           {"order", required_argument, 0, 'O'},
+                                           {"chunk", required_argument, 0, 'C'},
+                                           {"sigma", required_argument, 0, 's'},
+                                           {"block", required_argument, 0, 'b'},
+                                           {0, 0, 0, 0}};
+
+    int c;
+    while ((c = getopt_long(argc, argv, "t:n:W:r:F:R:T:Pf:S:k:p:oiHw:EJ:O:C:s:b:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 't':
+            opt.strategy = optarg;
+            break;
+        case 'n':
+            opt.iters = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'W':
+            opt.warmup = atoi(optarg) > 0 ? atoi(optarg) : 0;
+            break;
+        case 'r':
+            opt.repeat = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'F':
+            if (strcmp(optarg, "text") == 0)
+                opt.output = OUTPUT_TEXT;
+            else if (strcmp(optarg, "json") == 0)
+                opt.output = OUTPUT_JSON;
+            else if (strcmp(optarg, "csv") == 0)
+                opt.output = OUTPUT_CSV;
+            else
+                reject(rank, argv[0], "Unknown output %s\n", optarg);
+            break;
+        case 'R':
+            opt.results = optarg;
+            break;
+        case 'T':
+            opt.stream_mb = atoi(optarg) > 0 ? atoi(optarg) : 0;
+            break;
+        case 'P':
+            opt.counters = 1;
+            break;
+        case 'f':
+            opt.format = parse_format(optarg);
+            if (opt.format < 0)
+                reject(rank, argv[0], "Unknown format %s\n", optarg);
+            break;
+        case 'S':
+            if (strcmp(optarg, "static") == 0)
+                opt.schedule = SCHEDULE_STATIC;
+            else if (strcmp(optarg, "nnz") == 0)
+                opt.schedule = SCHEDULE_NNZ;
+            else if (strcmp(optarg, "merge") == 0)
+                opt.schedule = SCHEDULE_MERGE;
+            else
+                reject(rank, argv[0], "Unknown schedule %s\n", optarg);
+            break;
+        case 'k':
+            opt.num_vectors = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'p':
+            opt.steps = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        case 'o':
+            opt.overlap = 1;
+            break;
+        case 'i':
+            opt.ingest = 1;
+            break;
+        case 'H':
+            opt.part.hierarchical = 1;
+            break;
+        case 'w':
+            if (strcmp(optarg, "rows") == 0)
+                opt.part.weights = WEIGHTS_ROWS;
+            else if (strcmp(optarg, "nnz") == 0)
+                opt.part.weights = WEIGHTS_NNZ;
+            else if (strcmp(optarg, "nnz+sep") == 0)
+                opt.part.weights = WEIGHTS_NNZ_SEPARATORS;
+            else
+                reject(rank, argv[0], "Unknown weights %s\n", optarg);
+            break;
+        case 'E':
+            opt.part.edge_weights = 1;
+            break;
+        case 'J':
+            if (strcmp(optarg, "cut") == 0)
+                opt.part.objective = OBJECTIVE_CUT;
+            else if (strcmp(optarg, "vol") == 0)
+                opt.part.objective = OBJECTIVE_VOLUME;
+            else
+                reject(rank, argv[0], "Unknown objective %s\n", optarg);
+            break;
+        case 'O':
+            if (strcmp(optarg, "none") == 0)
+                opt.part.order = ORDER_NONE;
+            else if (strcmp(optarg, "rcm") == 0)
+                opt.part.order = ORDER_RCM;
+            else if (strcmp(optarg, "degree") == 0)
+                opt.part.order = ORDER_DEGREE;
+            else if (strcmp(optarg, "bfs") == 0)
+                opt.part.order = ORDER_BFS;
+            else
+                reject(rank, argv[0], "Unknown order %s\n", optarg);
+            break;
+        case 'C':
+            opt.sell_c = atoi(optarg);
+            break;
+        case 's':
+            opt.sell_sigma = atoi(optarg);
+            break;
+        case 'b': {
+            // B or RxC with positive sizes and nothing after them
+            int r = 0, cols = 0, end = 0;
+            if (sscanf(optarg, "%dx%d%n", &r, &cols, &end) != 2 && sscanf(optarg, "%d%n", &r, &end) == 1)
+                cols = r;
+            if (strcmp(optarg, "auto") == 0) {
+                opt.block_r = opt.block_c = 0;
+            } else if (end > 0 && optarg[end] == '\0' && r > 0 && cols > 0) {
+                opt.block_r = r;
+                opt.block_c = cols;
+            } else {
+                reject(rank, argv[0], "Unknown block size %s\n", optarg);
+            }
+            break;
+        }
+        default:
+            reject(rank, argv[0], NULL);
+        }
+    }
+
+    if (optind >= argc)
+        reject(rank, argv[0], NULL);
+    opt.path = argv[optind];
+    opt.part.cache_path = opt.path;
+    // parse_generator reports its errors itself, so it only runs on rank 0
+    generator gen;
+    int invalid = rank == 0 && is_generated(opt.path) && parse_generator(opt.path, &gen) != 0;
+    MPI_Bcast(&invalid, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (invalid)
+        reject(rank, NULL, NULL);
+
+    // spmm_part is a static-schedule CSR kernel
+    if (opt.num_vectors > 1 && opt.format != FORMAT_CSR)
+        reject(rank, NULL, "--vectors is only supported with --format csr\n");
+    if (opt.num_vectors > 1 && opt.schedule != SCHEDULE_STATIC)
+        reject(rank, NULL, "--vectors is only supported with --schedule static\n");
+    if (opt.steps > 1 && opt.num_vectors > 1)
+        reject(rank, NULL, "--sstep and --vectors cannot be combined\n");
+    if (opt.steps > 1 && opt.overlap)
+        reject(rank, NULL, "--sstep and --overlap cannot be combined\n");
+    // Ingested rows keep the file order, so there is no boundary-first split to overlap and
+    // none of the METIS options apply
+    if (opt.ingest && opt.overlap)
+        reject(rank, NULL, "--ingest and --overlap cannot be combined\n");
+    if (opt.ingest && (opt.part.hierarchical || opt.part.weights != WEIGHTS_ROWS || opt.part.edge_weights ||
+                       opt.part.objective != OBJECTIVE_CUT || opt.part.order != ORDER_NONE)) {
+        reject(rank, NULL, "--ingest does not partition, it cannot be combined with --hierarchical, --weights,\n"
+                           "--edge-weights, --objective or --order\n");
+    }
+    // The ingest split is fixed before tune_kernel knows the block size, so BCSR blocks would
+    // straddle the ranks
+    if (opt.ingest && opt.format == FORMAT_BCSR)
+        reject(rank, NULL, "--ingest and --format bcsr cannot be combined\n");
+
+    return opt;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "spmv.h"
+
+// Result format of the benchmark driver
+typedef enum { OUTPUT_TEXT, OUTPUT_JSON, OUTPUT_CSV } output_format;
+
+typedef struct {
+    const char *path;
+    const char *strategy; // name or alias of a strategy in bench.c
+    int iters, warmup;    // timed and untimed products per run
+    int repeat;           // timed runs, reported as percentiles
+    output_format output;
+    const char *results;  // file json and csv results are appended to, NULL for stdout
+    int stream_mb;        // STREAM triad arrays per node in MB, 0 skips the peak bandwidth
+    int counters;         // hardware events of every phase through perf_event_open
+    int format, schedule;
+    int num_vectors;
+    int steps;   // SpMVs per halo exchange, > 1 uses the matrix powers kernel
+    int overlap; // computes interior rows while the halo exchange is in flight
+    int ingest;  // every rank reads its own rows instead of rank 0 parsing and partitioning
+    int sell_c, sell_sigma;
+    int block_r, block_c; // BCSR block size, 0 detects it from the fill ratio
+    partition_options part;
+} options;
+
+options options_default(void);
+
+// Collective over MPI_COMM_WORLD, on invalid options rank 0 prints the usage and every rank exits
+options parse_options(int argc, char **argv, int rank);
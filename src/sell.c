@@ -0,0 +1,201 @@
+#include "sell.h"
+#include <stdlib.h>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#define SELL_MAX_C 64
+
+typedef struct {
+    int len, row;
+} row_len;
+
+static int compare_row_len(const void *a, const void *b) {
+    const row_len *ra = a, *rb = b;
+    if (ra->len != rb->len)
+        return rb->len - ra->len;
+    return ra->row - rb->row;
+}
+
+static void *alloc_aligned(size_t size) {
+    size = (size + 63) / 64 * 64;
+    return aligned_alloc(64, size > 0 ? size : 64);
+}
+
+SELL build_sell(CSR g, int s, int t, int C, int sigma) {
+    SELL m;
+    if (C < 1)
+        C = 1;
+    if (C > SELL_MAX_C)
+        C = SELL_MAX_C;
+    // Windows must hold whole chunks, otherwise a chunk would mix unsorted rows
+    if (sigma < C)
+        sigma = C;
+    sigma = (sigma + C - 1) / C * C;
+
+    m.num_rows = t - s;
+    m.C = C;
+    m.sigma = sigma;
+    m.num_chunks = (m.num_rows + C - 1) / C;
+
+    row_len *rows = malloc(sizeof(row_len) * (m.num_rows + 1));
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < m.num_rows; i++) {
+        rows[i].len = g.row_ptr[s + i + 1] - g.row_ptr[s + i];
+        rows[i].row = i;
+    }
+
+    int num_windows = (m.num_rows + sigma - 1) / sigma;
+#pragma omp parallel for schedule(dynamic)
+    for (int w = 0; w < num_windows; w++) {
+        int n = m.num_rows - w * sigma < sigma ? m.num_rows - w * sigma : sigma;
+        qsort(rows + w * sigma, n, sizeof(row_len), compare_row_len);
+    }
+
+    m.perm = malloc(sizeof(int) * (m.num_chunks * C + 1));
+    m.chunk_len = malloc(sizeof(int) * (m.num_chunks + 1));
+    m.chunk_ptr = malloc(sizeof(int) * (m.num_chunks + 1));
+
+#pragma omp parallel for schedule(static)
+    for (int c = 0; c < m.num_chunks; c++) {
+        int len = 0;
+        for (int l = 0; l < C; l++) {
+            int slot = c * C + l;
+            if (slot < m.num_rows) {
+                m.perm[slot] = rows[slot].row;
+                if (rows[slot].len > len)
+                    len = rows[slot].len;
+            } else {
+                m.perm[slot] = -1;
+            }
+        }
+        m.chunk_len[c] = len;
+    }
+
+    m.chunk_ptr[0] = 0;
+    for (int c = 0; c < m.num_chunks; c++)
+        m.chunk_ptr[c + 1] = m.chunk_ptr[c] + m.chunk_len[c] * C;
+
+    int size = m.chunk_ptr[m.num_chunks];
+    m.col_idx = alloc_aligned(sizeof(int) * size);
+    m.values = alloc_aligned(sizeof(double) * size);
+
+#pragma omp parallel for schedule(static)
+    for (int c = 0; c < m.num_chunks; c++) {
+        for (int l = 0; l < C; l++) {
+            int slot = c * C + l;
+            int start = 0, len = 0;
+            if (slot < m.num_rows) {
+                start = g.row_ptr[s + m.perm[slot]];
+                len = g.row_ptr[s + m.perm[slot] + 1] - start;
+            }
+
+            // Padding reuses the last column of the row so the gather stays in cache
+            int pad = len > 0 ? g.col_idx[start + len - 1] : 0;
+            for (int j = 0; j < m.chunk_len[c]; j++) {
+                int i = m.chunk_ptr[c] + j * C + l;
+                m.col_idx[i] = j < len ? g.col_idx[start + j] : pad;
+                m.values[i] = j < len ? g.values[start + j] : 0.0;
+            }
+        }
+    }
+
+    free(rows);
+    return m;
+}
+
+static inline void store_chunk(SELL m, int c, int s, const double *z, double *y) {
+    for (int l = 0; l < m.C; l++) {
+        int slot = c * m.C + l;
+        if (slot < m.num_rows)
+            y[s + m.perm[slot]] = z[l];
+    }
+}
+
+#if defined(__AVX512F__)
+static void spmv_sell_avx512(SELL m, int s, double *x, double *y) {
+#pragma omp parallel for schedule(static)
+    for (int c = 0; c < m.num_chunks; c++) {
+        const int *col = m.col_idx + m.chunk_ptr[c];
+        const double *val = m.values + m.chunk_ptr[c];
+        __m512d z = _mm512_setzero_pd();
+        for (int j = 0; j < m.chunk_len[c]; j++) {
+            __m256i idx = _mm256_load_si256((const __m256i *)(col + j * 8));
+            __m512d xv = _mm512_i32gather_pd(idx, x, 8);
+            z = _mm512_fmadd_pd(_mm512_load_pd(val + j * 8), xv, z);
+        }
+        double out[8] __attribute__((aligned(64)));
+        _mm512_store_pd(out, z);
+        store_chunk(m, c, s, out, y);
+    }
+}
+#endif
+
+#if defined(__AVX2__)
+static void spmv_sell_avx2(SELL m, int s, double *x, double *y) {
+#pragma omp parallel for schedule(static)
+    for (int c = 0; c < m.num_chunks; c++) {
+        const int *col = m.col_idx + m.chunk_ptr[c];
+        const double *val = m.values + m.chunk_ptr[c];
+        __m256d z = _mm256_setzero_pd();
+        for (int j = 0; j < m.chunk_len[c]; j++) {
+            __m128i idx = _mm_load_si128((const __m128i *)(col + j * 4));
+            __m256d xv = _mm256_i32gather_pd(x, idx, 8);
+#if defined(__FMA__)
+            z = _mm256_fmadd_pd(_mm256_load_pd(val + j * 4), xv, z);
+#else
+            z = _mm256_add_pd(z, _mm256_mul_pd(_mm256_load_pd(val + j * 4), xv));
+#endif
+        }
+        double out[4] __attribute__((aligned(32)));
+        _mm256_store_pd(out, z);
+        store_chunk(m, c, s, out, y);
+    }
+}
+#endif
+
+static void spmv_sell_generic(SELL m, int s, double *x, double *y) {
+#pragma omp parallel for schedule(static)
+    for (int c = 0; c < m.num_chunks; c++) {
+        const int *col = m.col_idx + m.chunk_ptr[c];
+        const double *val = m.values + m.chunk_ptr[c];
+        double z[SELL_MAX_C] = {0.0};
+        for (int j = 0; j < m.chunk_len[c]; j++) {
+            for (int l = 0; l < m.C; l++)
+                z[l] += val[j * m.C + l] * x[col[j * m.C + l]];
+        }
+        store_chunk(m, c, s, z, y);
+    }
+}
+
+void spmv_sell(SELL m, int s, double *x, double *y) {
+#if defined(__AVX512F__)
+    if (m.C == 8) {
+        spmv_sell_avx512(m, s, x, y);
+        return;
+    }
+#endif
+#if defined(__AVX2__)
+    if (m.C == 4) {
+        spmv_sell_avx2(m, s, x, y);
+        return;
+    }
+#endif
+    spmv_sell_generic(m, s, x, y);
+}
+
+void free_sell(SELL *m) {
+    free(m->chunk_ptr);
+    free(m->chunk_len);
+    free(m->perm);
+    free(m->col_idx);
+    free(m->values);
+    m->chunk_ptr = NULL;
+    m->chunk_len = NULL;
+    m->perm = NULL;
+    m->col_idx = NULL;
+    m->values = NULL;
+    m->num_rows = 0;
+    m->num_chunks = 0;
+}
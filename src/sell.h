@@ -0,0 +1,18 @@
+#pragma once
+#include "mtx.h"
+
+// SELL-C-sigma: rows are sorted by length inside windows of sigma rows and packed
+// into chunks of C rows stored column-major, so one vector lane handles one row.
+typedef struct {
+    int num_rows, C, sigma, num_chunks;
+    int *chunk_ptr, *chunk_len;
+    int *perm; // perm[i] is the row (relative to the first row) stored in slot i
+    int *col_idx;
+    double *values;
+} SELL;
+
+SELL build_sell(CSR g, int s, int t, int C, int sigma);
+
+void spmv_sell(SELL m, int s, double *x, double *y);
+
+void free_sell(SELL *m);
@@ -1,4 +1,5 @@
 #include "spmv.h"
+#include "csrcache.h"
 #include <metis.h>
 #include <mpi.h>
 #include <stdlib.h>
@@ -27,126 +28,651 @@ void spmv_part(CSR g, int rank, int row_ptr_start_idx, int row_ptr_end_idx, doub
     }
 }
 
-void partition_graph(CSR g, int num_partitions, int *partition_idx) {
-    if (num_partitions == 1) {
-        partition_idx[0] = 0;
-        partition_idx[1] = g.num_rows;
+// One kernel per block width, the constant width keeps the k partial sums in registers
+#define SPMM_KERNEL(K)                                                                                                 \
+    static void spmm_part_##K(CSR g, int s, int t, double *X, double *Y) {                                             \
+        _Pragma("omp parallel for schedule(static)") for (int u = s; u < t; u++) {                                     \
+            double z[K] = {0.0};                                                                                       \
+            for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {                                                    \
+                const double *xv = X + (size_t)g.col_idx[i] * K;                                                       \
+                for (int j = 0; j < K; j++)                                                                            \
+                    z[j] += g.values[i] * xv[j];                                                                       \
+            }                                                                                                          \
+            for (int j = 0; j < K; j++)                                                                                \
+                Y[(size_t)u * K + j] = z[j];                                                                           \
+        }                                                                                                              \
+    }
+
+SPMM_KERNEL(2)
+SPMM_KERNEL(4)
+SPMM_KERNEL(8)
+
+// X and Y are row-major blocks of k vectors, every matrix entry is loaded once for all k
+void spmm_part(CSR g, int rank, int s, int t, int k, double *X, double *Y) {
+    if (k == 1) {
+        spmv_part(g, rank, s, t, X, Y);
+        return;
+    }
+    if (k == 2) {
+        spmm_part_2(g, s, t, X, Y);
+        return;
+    }
+    if (k == 4) {
+        spmm_part_4(g, s, t, X, Y);
+        return;
+    }
+    if (k == 8) {
+        spmm_part_8(g, s, t, X, Y);
         return;
     }
 
-    int ncon = 1;
-    int objval;
-    real_t ubvec = 1.01;
-    int *part = malloc(sizeof(int) * g.num_rows);
-    int rc = METIS_PartGraphKway(&g.num_rows, &ncon, g.row_ptr, g.col_idx, NULL, NULL, NULL, &num_partitions, NULL,
-                                 &ubvec, NULL, &objval, part);
-
-    // new_id[i] stores the new position of node i
-    // old_id[i] stores the old position of node i
-    int *new_id = malloc(sizeof(int) * g.num_rows);
-    int *old_id = malloc(sizeof(int) * g.num_rows);
-    int id = 0;
-    partition_idx[0] = 0;
-    for (int r = 0; r < num_partitions; r++) {
-        for (int i = 0; i < g.num_rows; i++) {
-            if (part[i] == r) {
-                old_id[id] = i;
-                new_id[i] = id++;
+#pragma omp parallel for schedule(static)
+    for (int u = s; u < t; u++) {
+        double *yu = Y + (size_t)u * k;
+        for (int j = 0; j < k; j++)
+            yu[j] = 0.0;
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            const double *xv = X + (size_t)g.col_idx[i] * k;
+            for (int j = 0; j < k; j++)
+                yu[j] += g.values[i] * xv[j];
+        }
+    }
+}
+
+// Rows [s, t) split so that every thread gets the same number of nonzeros, rows are not split
+void spmv_part_balanced(CSR g, int *bounds, int num_threads, double *x, double *y) {
+#pragma omp parallel for schedule(static, 1)
+    for (int tid = 0; tid < num_threads; tid++) {
+        for (int u = bounds[tid]; u < bounds[tid + 1]; u++) {
+            double z = 0.0;
+            for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+                int v = g.col_idx[i];
+                z += x[v] * g.values[i];
             }
+            y[u] = z;
         }
-        partition_idx[r + 1] = id;
     }
+}
 
-    int *new_V = malloc(sizeof(int) * (g.num_rows + 1));
-    int *new_E = malloc(sizeof(int) * g.num_cols);
-    double *new_A = malloc(sizeof(double) * g.num_cols);
+// Finds the coordinate where diagonal d crosses the merge path of row ends and nonzeros
+static void merge_path_search(CSR g, int s, int t, int d, int *row, int *nz) {
+    int base = g.row_ptr[s];
+    int lo = d - (g.row_ptr[t] - base) > 0 ? d - (g.row_ptr[t] - base) : 0;
+    int hi = d < t - s ? d : t - s;
+
+    while (lo < hi) {
+        int pivot = lo + (hi - lo) / 2;
+        if (g.row_ptr[s + pivot + 1] - base <= d - pivot - 1)
+            lo = pivot + 1;
+        else
+            hi = pivot;
+    }
 
-    new_V[0] = 0;
-    for (int i = 0; i < g.num_rows; i++) {
-        int d = g.row_ptr[old_id[i] + 1] - g.row_ptr[old_id[i]];
-        new_V[i + 1] = new_V[i] + d;
-        memcpy(new_E + new_V[i], g.col_idx + g.row_ptr[old_id[i]], sizeof(int) * d);
-        memcpy(new_A + new_V[i], g.values + g.row_ptr[old_id[i]], sizeof(double) * d);
+    *row = s + lo;
+    *nz = base + d - lo;
+}
 
-        for (int j = new_V[i]; j < new_V[i + 1]; j++) {
-            new_E[j] = new_id[new_E[j]];
+merge_schedule init_merge_schedule(CSR g, int s, int t, int num_threads) {
+    merge_schedule m = {.num_threads = num_threads,
+                        .row_start = malloc(sizeof(int) * (num_threads + 1)),
+                        .nz_start = malloc(sizeof(int) * (num_threads + 1)),
+                        .carry_row = malloc(sizeof(int) * num_threads),
+                        .carry_val = malloc(sizeof(double) * num_threads)};
+
+    int total = (t - s) + (g.row_ptr[t] - g.row_ptr[s]);
+    int per_thread = (total + num_threads - 1) / num_threads;
+    for (int tid = 0; tid <= num_threads; tid++) {
+        int d = per_thread * tid < total ? per_thread * tid : total;
+        merge_path_search(g, s, t, d, m.row_start + tid, m.nz_start + tid);
+    }
+
+    return m;
+}
+
+// Every thread gets the same share of rows plus nonzeros, long rows are split between
+// threads and the partial sums of the last row of each thread are added afterwards
+void spmv_part_merge(CSR g, merge_schedule m, double *x, double *y) {
+#pragma omp parallel for schedule(static, 1)
+    for (int tid = 0; tid < m.num_threads; tid++) {
+        int u = m.row_start[tid], i = m.nz_start[tid];
+
+        for (; u < m.row_start[tid + 1]; u++) {
+            double z = 0.0;
+            for (; i < g.row_ptr[u + 1]; i++)
+                z += x[g.col_idx[i]] * g.values[i];
+            y[u] = z;
         }
+
+        double z = 0.0;
+        for (; i < m.nz_start[tid + 1]; i++)
+            z += x[g.col_idx[i]] * g.values[i];
+        m.carry_row[tid] = u;
+        m.carry_val[tid] = z;
     }
 
-    memcpy(g.row_ptr, new_V, sizeof(int) * (g.num_rows + 1));
-    memcpy(g.col_idx, new_E, sizeof(int) * g.num_cols);
-    memcpy(g.values, new_A, sizeof(double) * g.num_cols);
+    int t = m.row_start[m.num_threads];
+    for (int tid = 0; tid < m.num_threads; tid++)
+        if (m.carry_row[tid] < t)
+            y[m.carry_row[tid]] += m.carry_val[tid];
+}
 
-    free(new_V);
-    free(new_E);
-    free(new_A);
+void free_merge_schedule(merge_schedule *m) {
+    free(m->row_start);
+    free(m->nz_start);
+    free(m->carry_row);
+    free(m->carry_val);
+    m->row_start = NULL;
+    m->nz_start = NULL;
+    m->carry_row = NULL;
+    m->carry_val = NULL;
+    m->num_threads = 0;
+}
 
-    free(new_id);
-    free(old_id);
-    free(part);
+// The graph METIS partitions: the pattern of A + A^T without self loops, which is what METIS
+// expects and what a rank's communication follows, since x_j is needed by every row touching
+// column j and row j alike. weight is NULL for unit edge weights, otherwise edge (u, v) counts
+// how many of a_uv and a_vu are stored.
+typedef struct {
+    CSR g;
+    int *weight;
+} metis_graph;
+
+typedef struct {
+    int v, w;
+} weighted_edge;
+
+static int compare_edge(const void *a, const void *b) {
+    const weighted_edge *x = a, *y = b;
+    return (x->v > y->v) - (x->v < y->v);
 }
 
-void partition_graph_1b(CSR g, int num_partitions, int *partition_idx, comm_lists *c) {
-    if (num_partitions == 1) {
-        partition_idx[0] = 0;
-        partition_idx[1] = g.num_rows;
-        return;
+// Sorts edges[0..n) of vertex u, merges equal targets by summing their weights and drops
+// self loops. The merged edges stay at the front, their count is returned.
+static int merge_edges(weighted_edge *edges, int n, int u) {
+    qsort(edges, n, sizeof(weighted_edge), compare_edge);
+    int d = 0;
+    for (int i = 0; i < n; i++) {
+        if (edges[i].v == u)
+            continue;
+        if (d > 0 && edges[d - 1].v == edges[i].v)
+            edges[d - 1].w += edges[i].w;
+        else
+            edges[d++] = edges[i];
+    }
+    return d;
+}
+
+static void free_metis_graph(metis_graph *a) {
+    free_graph(&a->g);
+    free(a->weight);
+    a->weight = NULL;
+}
+
+// Row u of A + A^T is row u of A merged with column u of A. Both are gathered into a slot of
+// their combined length, merged there in parallel and finally compacted.
+static metis_graph symmetrize_graph(CSR g, int weighted) {
+    int n = g.num_rows;
+    int *t_ptr = calloc(n + 1, sizeof(int));
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        for (int j = g.row_ptr[i]; j < g.row_ptr[i + 1]; j++) {
+#pragma omp atomic
+            t_ptr[g.col_idx[j] + 1]++;
+        }
+    }
+    for (int i = 0; i < n; i++)
+        t_ptr[i + 1] += t_ptr[i];
+
+    // Column u of A, in whatever order the rows claim their slots
+    int *cursor = malloc(sizeof(int) * (n + 1));
+    memcpy(cursor, t_ptr, sizeof(int) * (n + 1));
+    int *t_idx = malloc(sizeof(int) * ((size_t)t_ptr[n] + 1));
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        for (int j = g.row_ptr[i]; j < g.row_ptr[i + 1]; j++) {
+            int slot;
+#pragma omp atomic capture
+            slot = cursor[g.col_idx[j]]++;
+            t_idx[slot] = i;
+        }
+    }
+    free(cursor);
+
+    weighted_edge *edges = malloc(sizeof(weighted_edge) * ((size_t)g.row_ptr[n] + t_ptr[n] + 1));
+    int *degree = malloc(sizeof(int) * (n + 1));
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int u = 0; u < n; u++) {
+        weighted_edge *e = edges + g.row_ptr[u] + t_ptr[u];
+        int m = 0;
+        for (int j = g.row_ptr[u]; j < g.row_ptr[u + 1]; j++)
+            e[m++] = (weighted_edge){g.col_idx[j], 1};
+        for (int j = t_ptr[u]; j < t_ptr[u + 1]; j++)
+            e[m++] = (weighted_edge){t_idx[j], 1};
+        degree[u] = merge_edges(e, m, u);
+    }
+    free(t_idx);
+
+    metis_graph a = {.g = {.num_rows = n, .values = NULL}, .weight = NULL};
+    a.g.row_ptr = malloc(sizeof(int) * (n + 1));
+    a.g.row_ptr[0] = 0;
+    for (int u = 0; u < n; u++)
+        a.g.row_ptr[u + 1] = a.g.row_ptr[u] + degree[u];
+    a.g.num_cols = a.g.row_ptr[n];
+    a.g.col_idx = malloc(sizeof(int) * ((size_t)a.g.num_cols + 1));
+    if (weighted)
+        a.weight = malloc(sizeof(int) * ((size_t)a.g.num_cols + 1));
+
+#pragma omp parallel for schedule(static)
+    for (int u = 0; u < n; u++) {
+        weighted_edge *e = edges + g.row_ptr[u] + t_ptr[u];
+        for (int d = 0; d < degree[u]; d++) {
+            a.g.col_idx[a.g.row_ptr[u] + d] = e[d].v;
+            if (weighted)
+                a.weight[a.g.row_ptr[u] + d] = e[d].w;
+        }
+    }
+
+    free(edges);
+    free(degree);
+    free(t_ptr);
+    return a;
+}
+
+// Graph of dof blocks: block i is rows [i * b, (i + 1) * b), without self loops. Edge weights,
+// when a has them, add up over the row edges between two blocks.
+static metis_graph compress_graph(metis_graph a, int b) {
+    CSR g = a.g;
+    metis_graph c = {.weight = NULL};
+    CSR q;
+    q.num_rows = (g.num_rows + b - 1) / b;
+    q.row_ptr = malloc(sizeof(int) * (q.num_rows + 1));
+    q.values = NULL;
+
+    int *degree = malloc(sizeof(int) * q.num_rows);
+
+    for (int pass = 0; pass < 2; pass++) {
+#pragma omp parallel
+        {
+            int cap = 0;
+            weighted_edge *buffer = NULL;
+
+#pragma omp for schedule(dynamic, 64)
+            for (int u = 0; u < q.num_rows; u++) {
+                int s = u * b, t = (u + 1) * b < g.num_rows ? (u + 1) * b : g.num_rows;
+                int n = g.row_ptr[t] - g.row_ptr[s];
+                if (n > cap) {
+                    cap = n;
+                    buffer = realloc(buffer, sizeof(weighted_edge) * cap);
+                }
+
+                for (int i = 0; i < n; i++) {
+                    buffer[i].v = g.col_idx[g.row_ptr[s] + i] / b;
+                    buffer[i].w = a.weight != NULL ? a.weight[g.row_ptr[s] + i] : 1;
+                }
+                int d = merge_edges(buffer, n, u);
+
+                if (pass == 1) {
+                    for (int i = 0; i < d; i++) {
+                        q.col_idx[q.row_ptr[u] + i] = buffer[i].v;
+                        if (c.weight != NULL)
+                            c.weight[q.row_ptr[u] + i] = buffer[i].w;
+                    }
+                }
+                degree[u] = d;
+            }
+
+            free(buffer);
+        }
+
+        if (pass == 0) {
+            q.row_ptr[0] = 0;
+            for (int u = 0; u < q.num_rows; u++)
+                q.row_ptr[u + 1] = q.row_ptr[u] + degree[u];
+            q.num_cols = q.row_ptr[q.num_rows];
+            q.col_idx = malloc(sizeof(int) * (q.num_cols + 1));
+            if (a.weight != NULL)
+                c.weight = malloc(sizeof(int) * (q.num_cols + 1));
+        }
+    }
+
+    free(degree);
+    c.g = q;
+    return c;
+}
+
+// Vertex weights of the METIS graph, vertex i covers rows [i * b, (i + 1) * b) of the n rows
+// with row_nnz[u] nonzeros each: their nonzeros, followed by their separator rows when sep is
+// given (ncon = 2)
+static int *vertex_weights(const int *row_nnz, int n, int b, int num_vertices, int *sep) {
+    int ncon = sep != NULL ? 2 : 1;
+    int *vwgt = malloc(sizeof(int) * ((size_t)num_vertices * ncon + 1));
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < num_vertices; i++) {
+        int s = i * b, t = (i + 1) * b < n ? (i + 1) * b : n;
+        int w = 0, m = 0;
+        for (int u = s; u < t; u++)
+            w += row_nnz[u];
+        // METIS rejects zero weights in a constraint that is otherwise positive
+        vwgt[(size_t)i * ncon] = w > 0 ? w : 1;
+        if (sep != NULL) {
+            for (int u = s; u < t; u++)
+                m += sep[u];
+            vwgt[(size_t)i * ncon + 1] = m;
+        }
     }
+    return vwgt;
+}
 
-    int ncon = 1;
+static int *metis_call(metis_graph a, const int *row_nnz, int num_partitions, real_t *tpwgts, partition_options po,
+                       int *sep) {
+    CSR g = a.g;
+    int ncon = sep != NULL ? 2 : 1;
     int objval;
-    real_t ubvec = 1.01;
-    int *part = malloc(sizeof(int) * g.num_rows);
-    int rc = METIS_PartGraphKway(&g.num_rows, &ncon, g.row_ptr, g.col_idx, NULL, NULL, NULL, &num_partitions, NULL,
-                                 &ubvec, NULL, &objval, part);
+    // Separator counts are far smaller than nnz, they get a looser tolerance
+    real_t ubvec[2] = {1.01, 1.05};
+    int *part = malloc(sizeof(int) * (g.num_rows + 1));
+
+    idx_t metis_options[METIS_NOPTIONS];
+    METIS_SetDefaultOptions(metis_options);
+    if (po.objective == OBJECTIVE_VOLUME)
+        metis_options[METIS_OPTION_OBJTYPE] = METIS_OBJTYPE_VOL;
+
+    // Partition whole dof blocks so that a block never straddles two ranks
+    int b = po.block_size > 1 ? po.block_size : 1;
+    metis_graph q = b > 1 ? compress_graph(a, b) : a;
+    int *vwgt = po.weights != WEIGHTS_ROWS ? vertex_weights(row_nnz, g.num_rows, b, q.g.num_rows, sep) : NULL;
+
+    // With two constraints every part has a target weight per constraint
+    real_t *targets = NULL;
+    if (tpwgts != NULL && ncon > 1) {
+        targets = malloc(sizeof(real_t) * num_partitions * ncon);
+        for (int r = 0; r < num_partitions * ncon; r++)
+            targets[r] = tpwgts[r / ncon];
+    }
 
-    int *sep_marker = malloc(g.num_rows * sizeof(int));
-    for (int i = 0; i < num_partitions; i++)
-        c->send_count[i] = 0;
-    for (int i = 0; i < g.num_rows; i++)
-        sep_marker[i] = 0;
+    int *block_part = b > 1 ? malloc(sizeof(int) * q.g.num_rows) : part;
+    int rc = METIS_PartGraphKway(&q.g.num_rows, &ncon, q.g.row_ptr, q.g.col_idx, vwgt, NULL, q.weight,
+                                 &num_partitions, targets != NULL ? targets : tpwgts, ubvec, metis_options, &objval,
+                                 block_part);
+    // A failed call leaves part undefined, it must never reach the partition cache
+    if (rc != METIS_OK) {
+        fprintf(stderr, "METIS_PartGraphKway failed with code %d for %d parts\n", rc, num_partitions);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    if (b > 1) {
+        // A trailing partial block goes last, so every part starts on a block boundary
+        if (g.num_rows % b != 0)
+            block_part[q.g.num_rows - 1] = num_partitions - 1;
+
+        for (int i = 0; i < g.num_rows; i++)
+            part[i] = block_part[i / b];
 
-    int sep = 0;
+        free(block_part);
+        free_metis_graph(&q);
+    }
+    free(vwgt);
+    free(targets);
+    return part;
+}
+
+// Rows with an edge into another part
+static int *mark_separators(CSR g, int *part) {
+    int *sep = calloc(g.num_rows + 1, sizeof(int));
+#pragma omp parallel for schedule(static)
     for (int i = 0; i < g.num_rows; i++) {
         for (int j = g.row_ptr[i]; j < g.row_ptr[i + 1]; j++) {
             if (part[i] != part[g.col_idx[j]]) {
-                sep_marker[i] = 1;
-                c->send_count[part[i]]++;
+                sep[i] = 1;
                 break;
             }
         }
     }
+    return sep;
+}
 
-    int *new_id = malloc(sizeof(int) * g.num_rows);
-    int *old_id = malloc(sizeof(int) * g.num_rows);
-    int id = 0;
-    partition_idx[0] = 0;
-    for (int r = 0; r < num_partitions; r++) {
-        for (int i = 0; i < g.num_rows; i++) {
-            if (part[i] == r && sep_marker[i]) {
-                old_id[id] = i;
-                new_id[i] = id++;
+static int *metis_partition_compute(metis_graph a, const int *row_nnz, int num_partitions, real_t *tpwgts,
+                                    partition_options po) {
+    if (po.weights != WEIGHTS_NNZ_SEPARATORS)
+        return metis_call(a, row_nnz, num_partitions, tpwgts, po, NULL);
+
+    // Separators only exist once there is a partition: a first nnz balanced one marks them,
+    // the second balances nnz and separator rows, which is what every rank sends, together
+    po.weights = WEIGHTS_NNZ;
+    int *first = metis_call(a, row_nnz, num_partitions, tpwgts, po, NULL);
+    int *sep = mark_separators(a.g, first);
+    po.weights = WEIGHTS_NNZ_SEPARATORS;
+    int *part = metis_call(a, row_nnz, num_partitions, tpwgts, po, sep);
+    free(first);
+    free(sep);
+    return part;
+}
+
+// Rows rows[0..n) of a with the edges between them, renumbered by local_id
+static metis_graph induced_graph(metis_graph a, int *rows, int n, int *local_id, int *member, int j) {
+    CSR g = a.g;
+    metis_graph s = {.g = {.num_rows = n, .values = NULL}, .weight = NULL};
+    CSR *q = &s.g;
+    q->row_ptr = malloc(sizeof(int) * (n + 1));
+    q->row_ptr[0] = 0;
+    for (int t = 0; t < n; t++) {
+        int d = 0;
+        for (int i = g.row_ptr[rows[t]]; i < g.row_ptr[rows[t] + 1]; i++)
+            d += member[g.col_idx[i]] == j;
+        q->row_ptr[t + 1] = q->row_ptr[t] + d;
+    }
+    q->num_cols = q->row_ptr[n];
+    q->col_idx = malloc(sizeof(int) * (q->num_cols + 1));
+    if (a.weight != NULL)
+        s.weight = malloc(sizeof(int) * (q->num_cols + 1));
+
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int t = 0; t < n; t++) {
+        int k = q->row_ptr[t];
+        for (int i = g.row_ptr[rows[t]]; i < g.row_ptr[rows[t] + 1]; i++) {
+            if (member[g.col_idx[i]] == j) {
+                if (s.weight != NULL)
+                    s.weight[k] = a.weight[i];
+                q->col_idx[k++] = local_id[g.col_idx[i]];
             }
         }
+    }
+    return s;
+}
 
+// Two levels: METIS first splits a over the nodes, weighted by their rank counts, then the
+// rows of every node over its ranks. Node cuts are then minimised on their own instead of
+// being traded against the far cheaper cuts inside a node.
+static int *hierarchical_partition(metis_graph a, const int *row_nnz, int k, partition_options po) {
+    CSR g = a.g;
+    int num_nodes = 0;
+    for (int r = 0; r < k; r++)
+        num_nodes = po.node_of[r] + 1 > num_nodes ? po.node_of[r] + 1 : num_nodes;
+    if (num_nodes <= 1 || num_nodes >= k)
+        return metis_partition_compute(a, row_nnz, k, NULL, po);
+
+    // Ranks grouped by node, node j holds node_ranks[node_ptr[j]..node_ptr[j + 1])
+    int *node_ptr = calloc(num_nodes + 1, sizeof(int)), *node_ranks = malloc(sizeof(int) * k);
+    for (int r = 0; r < k; r++)
+        node_ptr[po.node_of[r] + 1]++;
+    for (int j = 0; j < num_nodes; j++)
+        node_ptr[j + 1] += node_ptr[j];
+    int *cursor = malloc(sizeof(int) * num_nodes);
+    memcpy(cursor, node_ptr, sizeof(int) * num_nodes);
+    for (int r = 0; r < k; r++)
+        node_ranks[cursor[po.node_of[r]]++] = r;
+    free(cursor);
+
+    real_t *tpwgts = malloc(sizeof(real_t) * num_nodes);
+    for (int j = 0; j < num_nodes; j++)
+        tpwgts[j] = (real_t)(node_ptr[j + 1] - node_ptr[j]) / (real_t)k;
+    int *node_part = metis_partition_compute(a, row_nnz, num_nodes, tpwgts, po);
+    free(tpwgts);
+
+    int *part = malloc(sizeof(int) * (g.num_rows + 1));
+    int *rows = malloc(sizeof(int) * (g.num_rows + 1)), *local_id = malloc(sizeof(int) * (g.num_rows + 1));
+    int *sub_nnz = malloc(sizeof(int) * (g.num_rows + 1));
+    for (int j = 0; j < num_nodes; j++) {
+        int n = 0, ranks = node_ptr[j + 1] - node_ptr[j];
         for (int i = 0; i < g.num_rows; i++) {
-            if (part[i] == r && !sep_marker[i]) {
-                old_id[id] = i;
-                new_id[i] = id++;
+            if (node_part[i] == j) {
+                local_id[i] = n;
+                sub_nnz[n] = row_nnz[i];
+                rows[n++] = i;
+            }
+        }
+        if (n == 0)
+            continue;
+        if (ranks == 1) {
+            for (int t = 0; t < n; t++)
+                part[rows[t]] = node_ranks[node_ptr[j]];
+            continue;
+        }
+
+        metis_graph q = induced_graph(a, rows, n, local_id, node_part, j);
+        int *sub_part = metis_partition_compute(q, sub_nnz, ranks, NULL, po);
+        for (int t = 0; t < n; t++)
+            part[rows[t]] = node_ranks[node_ptr[j] + sub_part[t]];
+        free(sub_part);
+        free_metis_graph(&q);
+    }
+
+    free(rows);
+    free(local_id);
+    free(sub_nnz);
+    free(node_part);
+    free(node_ptr);
+    free(node_ranks);
+    return part;
+}
+
+// Vertex weights follow the nonzeros of g, the edges come from a
+static int *partition_rows(CSR g, metis_graph a, int num_partitions, partition_options po) {
+    int *row_nnz = malloc(sizeof(int) * (g.num_rows + 1));
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < g.num_rows; i++)
+        row_nnz[i] = g.row_ptr[i + 1] - g.row_ptr[i];
+
+    int *part = po.hierarchical && po.node_of != NULL
+                    ? hierarchical_partition(a, row_nnz, num_partitions, po)
+                    : metis_partition_compute(a, row_nnz, num_partitions, NULL, po);
+    free(row_nnz);
+    return part;
+}
+
+// METIS dominates the startup, so its part vector is cached next to the matrix. The
+// separators and orderings derived from it are cheap and recomputed on every run.
+static int *metis_partition(CSR g, metis_graph a, int num_partitions, partition_options po) {
+    if (po.cache_path == NULL)
+        return partition_rows(g, a, num_partitions, po);
+
+    int params[4] = {po.block_size, po.weights, po.objective, po.edge_weights};
+    uint64_t key = partition_key(g, num_partitions, params, 4, po.hierarchical ? po.node_of : NULL);
+    int *part = malloc(sizeof(int) * g.num_rows);
+    if (load_partition_cache(po.cache_path, key, g.num_rows, num_partitions, part) == 0) {
+        printf("Loaded partition cache %s.%d.part\n", po.cache_path, num_partitions);
+        return part;
+    }
+    free(part);
+
+    part = partition_rows(g, a, num_partitions, po);
+    if (save_partition_cache(po.cache_path, key, g.num_rows, num_partitions, part) != 0)
+        printf("Could not write partition cache %s.%d.part\n", po.cache_path, num_partitions);
+    return part;
+}
+
+// Measured balance of a partition: nonzeros and rows per part against their mean, and the
+// values every part sends per exchange, counted on the symmetrized pattern a: row i goes once
+// to every other part holding a neighbour. With node_of the volume is also split by whether
+// sender and receiver share a node.
+static void report_partition(CSR g, CSR a, int *part, int k, const int *node_of) {
+    long long inter = 0, intra = 0;
+    long long *nnz = calloc(k, sizeof(long long)), *rows = calloc(k, sizeof(long long));
+    long long *send = calloc(k, sizeof(long long));
+
+#pragma omp parallel reduction(+ : inter, intra)
+    {
+        int *seen = malloc(sizeof(int) * k);
+        long long *own_send = calloc(k, sizeof(long long));
+        for (int q = 0; q < k; q++)
+            seen[q] = -1;
+#pragma omp for schedule(static)
+        for (int i = 0; i < a.num_rows; i++) {
+            for (int j = a.row_ptr[i]; j < a.row_ptr[i + 1]; j++) {
+                int q = part[a.col_idx[j]];
+                if (q == part[i] || seen[q] == i)
+                    continue;
+                seen[q] = i;
+                own_send[part[i]]++;
+                if (node_of != NULL && node_of[q] == node_of[part[i]])
+                    intra++;
+                else
+                    inter++;
             }
         }
+#pragma omp critical
+        for (int q = 0; q < k; q++)
+            send[q] += own_send[q];
+        free(own_send);
+        free(seen);
+    }
 
-        partition_idx[r + 1] = id;
+    for (int i = 0; i < g.num_rows; i++) {
+        nnz[part[i]] += g.row_ptr[i + 1] - g.row_ptr[i];
+        rows[part[i]]++;
     }
 
+    long long max_nnz = 0, max_rows = 0, max_send = 0;
+    for (int q = 0; q < k; q++) {
+        max_nnz = nnz[q] > max_nnz ? nnz[q] : max_nnz;
+        max_rows = rows[q] > max_rows ? rows[q] : max_rows;
+        max_send = send[q] > max_send ? send[q] : max_send;
+    }
+
+    printf("Partition imbalance (max / mean): nnz = %.3f, rows = %.3f\n",
+           g.num_cols > 0 ? (double)max_nnz * k / g.num_cols : 1.0,
+           g.num_rows > 0 ? (double)max_rows * k / g.num_rows : 1.0);
+    printf("Send volume per exchange: max = %lld, total = %lld values\n", max_send, inter + intra);
+    if (node_of != NULL)
+        printf("Communication volume per exchange: inter-node = %lld, intra-node = %lld values\n", inter, intra);
+
+    free(nnz);
+    free(rows);
+    free(send);
+}
+
+// Separator blocks are kept whole, so separator-first orderings do not split a dof block
+static void mark_separator_blocks(int *sep_marker, int n, int b) {
+    if (b <= 1)
+        return;
+
+#pragma omp parallel for schedule(static)
+    for (int s = 0; s < n; s += b) {
+        int t = s + b < n ? s + b : n;
+        int mark = 0;
+        for (int i = s; i < t; i++)
+            mark |= sep_marker[i];
+        for (int i = s; i < t; i++)
+            sep_marker[i] = mark;
+    }
+}
+
+// Applies the permutation in place, old_id[i] is the old position of new row i
+static void relabel_graph(CSR g, int *old_id, int *new_id) {
     int *new_V = malloc(sizeof(int) * (g.num_rows + 1));
     int *new_E = malloc(sizeof(int) * g.num_cols);
     double *new_A = malloc(sizeof(double) * g.num_cols);
 
     new_V[0] = 0;
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < g.num_rows; i++)
+        new_V[i + 1] = g.row_ptr[old_id[i] + 1] - g.row_ptr[old_id[i]];
+    for (int i = 0; i < g.num_rows; i++)
+        new_V[i + 1] += new_V[i];
+
+#pragma omp parallel for schedule(dynamic, 256)
     for (int i = 0; i < g.num_rows; i++) {
-        int d = g.row_ptr[old_id[i] + 1] - g.row_ptr[old_id[i]];
-        new_V[i + 1] = new_V[i] + d;
+        int d = new_V[i + 1] - new_V[i];
         memcpy(new_E + new_V[i], g.col_idx + g.row_ptr[old_id[i]], sizeof(int) * d);
         memcpy(new_A + new_V[i], g.values + g.row_ptr[old_id[i]], sizeof(double) * d);
 
@@ -162,99 +688,351 @@ void partition_graph_1b(CSR g, int num_partitions, int *partition_idx, comm_list
     free(new_V);
     free(new_E);
     free(new_A);
+}
 
-    free(new_id);
-    free(old_id);
-    free(part);
+static void report_bandwidth(CSR g, const char *label) {
+    int bandwidth = 0;
+    long long profile = 0;
+#pragma omp parallel for schedule(static) reduction(max : bandwidth) reduction(+ : profile)
+    for (int u = 0; u < g.num_rows; u++) {
+        int lowest = u;
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            int v = g.col_idx[i], d = v > u ? v - u : u - v;
+            bandwidth = d > bandwidth ? d : bandwidth;
+            lowest = v < lowest ? v : lowest;
+        }
+        profile += u - lowest;
+    }
+    printf("%s: bandwidth = %d, profile = %lld\n", label, bandwidth, profile);
 }
 
-void partition_graph_1c(CSR g, int num_partitions, int *partition_idx, comm_lists *c) {
-    if (num_partitions == 1) {
-        partition_idx[0] = 0;
-        partition_idx[1] = g.num_rows;
+typedef struct {
+    int key, id;
+} keyed_row;
+
+static int compare_keyed_row(const void *a, const void *b) {
+    const keyed_row *ra = a, *rb = b;
+    if (ra->key != rb->key)
+        return (ra->key > rb->key) - (ra->key < rb->key);
+    return (ra->id > rb->id) - (ra->id < rb->id);
+}
+
+static inline int degree_of(CSR g, int u) { return g.row_ptr[u + 1] - g.row_ptr[u]; }
+
+// BFS over the unvisited rows of segment s, which starts at a, from root. Rows are marked with
+// round in mark (indexed by segment position). Returns the depth and the lowest degree last row.
+static int segment_depth(CSR g, const int *seg_of, const int *new_id, int s, int a, int root, const char *visited,
+                         int *mark, int round, int *queue, int *last) {
+    int head = 0, tail = 0, depth = 0;
+    queue[tail++] = root;
+    mark[new_id[root] - a] = round;
+    while (head < tail) {
+        int level_end = tail;
+        *last = queue[head];
+        for (int q = head; q < level_end; q++)
+            if (degree_of(g, queue[q]) < degree_of(g, *last))
+                *last = queue[q];
+        for (; head < level_end; head++) {
+            int u = queue[head];
+            for (int j = g.row_ptr[u]; j < g.row_ptr[u + 1]; j++) {
+                int v = g.col_idx[j];
+                if (seg_of[v] == s && !visited[v] && mark[new_id[v] - a] != round) {
+                    mark[new_id[v] - a] = round;
+                    queue[tail++] = v;
+                }
+            }
+        }
+        depth += tail > level_end;
+    }
+    return depth;
+}
+
+// George-Liu: restarts from the far end while the BFS depth grows, few rounds suffice
+static int peripheral_row(CSR g, const int *seg_of, const int *new_id, int s, int a, int root, const char *visited,
+                          int *mark, int *round, int *queue) {
+    int last, depth = segment_depth(g, seg_of, new_id, s, a, root, visited, mark, ++*round, queue, &last);
+    for (int i = 0; i < 8 && last != root; i++) {
+        int next, d = segment_depth(g, seg_of, new_id, s, a, last, visited, mark, ++*round, queue, &next);
+        if (d <= depth)
+            break;
+        root = last;
+        depth = d;
+        last = next;
+    }
+    return root;
+}
+
+// Orders the rows old_id[a..b) of segment s. Only edges inside the segment are followed.
+// Membership is read from seg_of, as other segments rewrite their new_id concurrently; new_id
+// is only read for rows of s. visited is shared but segments are disjoint.
+static void order_segment(CSR g, const int *seg_of, int *old_id, int *new_id, int s, int a, int b, row_order order,
+                          char *visited) {
+    int n = b - a;
+    if (n < 2)
         return;
+
+    keyed_row *rows = malloc(sizeof(keyed_row) * 2 * n);
+    int *out = malloc(sizeof(int) * n);
+    for (int i = 0; i < n; i++)
+        rows[i] = (keyed_row){degree_of(g, old_id[a + i]), old_id[a + i]};
+
+    if (order == ORDER_DEGREE) {
+        qsort(rows, n, sizeof(keyed_row), compare_keyed_row);
+        for (int i = 0; i < n; i++)
+            out[i] = rows[i].id;
+    } else {
+        // Every unvisited seed starts a new search. RCM takes the seeds by increasing degree and
+        // moves each start to a pseudo-peripheral row. BFS puts all rows with an edge leaving
+        // the segment, i.e. next to a separator or to another part, into its first level, then
+        // continues in row order.
+        int num_seeds = n, first_level = 1;
+        if (order == ORDER_RCM) {
+            qsort(rows, n, sizeof(keyed_row), compare_keyed_row);
+        } else {
+            first_level = 0;
+            for (int i = 0; i < n; i++) {
+                int u = old_id[a + i];
+                for (int j = g.row_ptr[u]; j < g.row_ptr[u + 1]; j++) {
+                    if (seg_of[g.col_idx[j]] != s) {
+                        rows[first_level++].id = u;
+                        break;
+                    }
+                }
+            }
+            for (int i = 0; i < n; i++)
+                rows[first_level + i].id = old_id[a + i];
+            num_seeds = first_level + n;
+        }
+
+        int head = 0, tail = 0, cap = 0, round = 0;
+        int *mark = order == ORDER_RCM ? calloc(n, sizeof(int)) : NULL;
+        int *queue = order == ORDER_RCM ? malloc(sizeof(int) * n) : NULL;
+        keyed_row *next = NULL;
+        for (int seed = 0; seed < num_seeds && tail < n; seed++) {
+            int root = rows[seed].id;
+            if (visited[root])
+                continue;
+            if (order == ORDER_RCM)
+                root = peripheral_row(g, seg_of, new_id, s, a, root, visited, mark, &round, queue);
+            visited[root] = 1;
+            out[tail++] = root;
+            if (seed + 1 < first_level)
+                continue;
+
+            while (head < tail) {
+                int u = out[head++], m = 0;
+                if (degree_of(g, u) > cap) {
+                    cap = degree_of(g, u);
+                    next = realloc(next, sizeof(keyed_row) * cap);
+                }
+                for (int j = g.row_ptr[u]; j < g.row_ptr[u + 1]; j++) {
+                    int v = g.col_idx[j];
+                    if (seg_of[v] == s && !visited[v]) {
+                        visited[v] = 1;
+                        next[m++] = (keyed_row){order == ORDER_RCM ? degree_of(g, v) : 0, v};
+                    }
+                }
+                qsort(next, m, sizeof(keyed_row), compare_keyed_row);
+                for (int i = 0; i < m; i++)
+                    out[tail++] = next[i].id;
+            }
+        }
+        free(next);
+        free(mark);
+        free(queue);
+
+        if (order == ORDER_RCM) {
+            for (int i = 0; i < n / 2; i++) {
+                int t = out[i];
+                out[i] = out[n - 1 - i];
+                out[n - 1 - i] = t;
+            }
+        }
     }
 
-    int ncon = 1;
-    int objval;
-    real_t ubvec = 1.01;
-    int *part = malloc(sizeof(int) * g.num_rows);
-    int rc = METIS_PartGraphKway(&g.num_rows, &ncon, g.row_ptr, g.col_idx, NULL, NULL, NULL, &num_partitions, NULL,
-                                 &ubvec, NULL, &objval, part);
+    for (int i = 0; i < n; i++) {
+        old_id[a + i] = out[i];
+        new_id[out[i]] = a + i;
+    }
+    free(rows);
+    free(out);
+}
 
-    int *sep_marker = malloc(g.num_rows * sizeof(int));
-    for (int i = 0; i < num_partitions; i++)
-        c->send_count[i] = 0;
-    for (int i = 0; i < g.num_rows; i++)
-        sep_marker[i] = 0;
+// Relabels g so that part r becomes rows [partition_idx[r], partition_idx[r + 1]), with its
+// separator rows first when sep_marker is given. The permutation is a stable counting sort on
+// (part, separator) and every resulting segment is then ordered on its own by po.order.
+static void apply_partition(CSR g, int k, int *part, int *sep_marker, int *partition_idx, partition_options po) {
+    int n = g.num_rows, num_keys = sep_marker != NULL ? 2 * k : k;
+    int *seg_ptr = calloc(num_keys + 1, sizeof(int));
+    int *new_id = malloc(sizeof(int) * (n + 1));
+    int *old_id = malloc(sizeof(int) * (n + 1));
+
+#define SEGMENT_KEY(i) (sep_marker != NULL ? 2 * part[i] + !sep_marker[i] : part[i])
+    for (int i = 0; i < n; i++)
+        seg_ptr[SEGMENT_KEY(i) + 1]++;
+    for (int s = 0; s < num_keys; s++)
+        seg_ptr[s + 1] += seg_ptr[s];
+    int *cursor = malloc(sizeof(int) * (num_keys + 1));
+    memcpy(cursor, seg_ptr, sizeof(int) * (num_keys + 1));
+    for (int i = 0; i < n; i++) {
+        int id = cursor[SEGMENT_KEY(i)]++;
+        old_id[id] = i;
+        new_id[i] = id;
+    }
+    free(cursor);
+
+    int stride = sep_marker != NULL ? 2 : 1;
+    for (int r = 0; r <= k; r++)
+        partition_idx[r] = seg_ptr[r * stride];
+
+    // Orders move single rows, which would split BCSR dof blocks
+    if (po.order != ORDER_NONE && po.block_size > 1)
+        printf("Row orders keep dof blocks whole only with block size 1, order skipped\n");
+    else if (po.order != ORDER_NONE) {
+        char *visited = calloc(n + 1, 1);
+        int *seg_of = malloc(sizeof(int) * (n + 1));
+#pragma omp parallel for schedule(static)
+        for (int i = 0; i < n; i++)
+            seg_of[i] = SEGMENT_KEY(i);
+#pragma omp parallel for schedule(dynamic)
+        for (int s = 0; s < num_keys; s++)
+            order_segment(g, seg_of, old_id, new_id, s, seg_ptr[s], seg_ptr[s + 1], po.order, visited);
+        free(seg_of);
+        free(visited);
+    }
+#undef SEGMENT_KEY
+
+    report_bandwidth(g, "Original order");
+    relabel_graph(g, old_id, new_id);
+    report_bandwidth(g, "Partitioned order");
 
-    int sep = 0;
+    free(seg_ptr);
+    free(new_id);
+    free(old_id);
+}
+
+// Rows with an edge of the symmetrized pattern g into another part. With mark_pairs every pair
+// of parts they connect is recorded in send_items, in both directions.
+static int *find_separators(CSR g, int *part, int num_partitions, comm_lists *c, int mark_pairs,
+                            partition_options po) {
+    int *sep_marker = calloc(g.num_rows + 1, sizeof(int));
+    for (int i = 0; i < num_partitions; i++) {
+        c->send_count[i] = 0;
+        if (mark_pairs)
+            memset(c->send_items[i], 0, sizeof(int) * num_partitions);
+    }
 
     for (int i = 0; i < g.num_rows; i++) {
         for (int j = g.row_ptr[i]; j < g.row_ptr[i + 1]; j++) {
             if (part[i] != part[g.col_idx[j]]) {
                 sep_marker[i] = 1;
-                c->send_count[part[i]]++;
+                if (!mark_pairs)
+                    break;
                 c->send_items[part[i]][part[g.col_idx[j]]] = 1;
                 c->send_items[part[g.col_idx[j]]][part[i]] = 1;
-                break;
             }
         }
     }
 
-    int *new_id = malloc(sizeof(int) * g.num_rows);
-    int *old_id = malloc(sizeof(int) * g.num_rows);
-    int id = 0;
-    partition_idx[0] = 0;
-    for (int r = 0; r < num_partitions; r++) {
-        for (int i = 0; i < g.num_rows; i++) {
-            if (part[i] == r && sep_marker[i]) {
-                old_id[id] = i;
-                new_id[i] = id++;
-            }
-        }
+    mark_separator_blocks(sep_marker, g.num_rows, po.block_size);
+    for (int i = 0; i < g.num_rows; i++)
+        c->send_count[part[i]] += sep_marker[i];
+    return sep_marker;
+}
 
-        for (int i = 0; i < g.num_rows; i++) {
-            if (part[i] == r && !sep_marker[i]) {
-                old_id[id] = i;
-                new_id[i] = id++;
-            }
-        }
+// A single part skips METIS, it is still ordered when an order is asked for
+static int *partition_vector(CSR g, metis_graph a, int num_partitions, partition_options po) {
+    if (num_partitions == 1)
+        return calloc(g.num_rows + 1, sizeof(int));
+    int *part = metis_partition(g, a, num_partitions, po);
+    report_partition(g, a.g, part, num_partitions, po.node_of);
+    return part;
+}
 
-        partition_idx[r + 1] = id;
+void partition_graph(CSR g, int num_partitions, int *partition_idx, partition_options po) {
+    if (num_partitions == 1 && po.order == ORDER_NONE) {
+        partition_idx[0] = 0;
+        partition_idx[1] = g.num_rows;
+        return;
     }
 
-    int *new_V = malloc(sizeof(int) * (g.num_rows + 1));
-    int *new_E = malloc(sizeof(int) * g.num_cols);
-    double *new_A = malloc(sizeof(double) * g.num_cols);
-
-    new_V[0] = 0;
-    for (int i = 0; i < g.num_rows; i++) {
-        int d = g.row_ptr[old_id[i] + 1] - g.row_ptr[old_id[i]];
-        new_V[i + 1] = new_V[i] + d;
-        memcpy(new_E + new_V[i], g.col_idx + g.row_ptr[old_id[i]], sizeof(int) * d);
-        memcpy(new_A + new_V[i], g.values + g.row_ptr[old_id[i]], sizeof(double) * d);
+    metis_graph a = symmetrize_graph(g, po.edge_weights);
+    int *part = partition_vector(g, a, num_partitions, po);
+    free_metis_graph(&a);
+    apply_partition(g, num_partitions, part, NULL, partition_idx, po);
+    free(part);
+}
 
-        for (int j = new_V[i]; j < new_V[i + 1]; j++) {
-            new_E[j] = new_id[new_E[j]];
-        }
+void partition_graph_1b(CSR g, int num_partitions, int *partition_idx, comm_lists *c, partition_options po) {
+    if (num_partitions == 1 && po.order == ORDER_NONE) {
+        partition_idx[0] = 0;
+        partition_idx[1] = g.num_rows;
+        return;
     }
 
-    memcpy(g.row_ptr, new_V, sizeof(int) * (g.num_rows + 1));
-    memcpy(g.col_idx, new_E, sizeof(int) * g.num_cols);
-    memcpy(g.values, new_A, sizeof(double) * g.num_cols);
+    metis_graph a = symmetrize_graph(g, po.edge_weights);
+    int *part = partition_vector(g, a, num_partitions, po);
+    int *sep_marker = find_separators(a.g, part, num_partitions, c, 0, po);
+    free_metis_graph(&a);
+    apply_partition(g, num_partitions, part, sep_marker, partition_idx, po);
+    free(sep_marker);
+    free(part);
+}
 
-    free(new_V);
-    free(new_E);
-    free(new_A);
+void partition_graph_1c(CSR g, int num_partitions, int *partition_idx, comm_lists *c, partition_options po) {
+    if (num_partitions == 1 && po.order == ORDER_NONE) {
+        partition_idx[0] = 0;
+        partition_idx[1] = g.num_rows;
+        return;
+    }
 
-    free(new_id);
-    free(old_id);
+    metis_graph a = symmetrize_graph(g, po.edge_weights);
+    int *part = partition_vector(g, a, num_partitions, po);
+    int *sep_marker = find_separators(a.g, part, num_partitions, c, 1, po);
+    free_metis_graph(&a);
+    apply_partition(g, num_partitions, part, sep_marker, partition_idx, po);
+    free(sep_marker);
     free(part);
 }
 
-void find_sendlists(CSR g, int *p, int rank, int size, comm_lists c) {
+// Breadth-first search from rows [s, t), which are level 0. Vertices reached within depth
+// hops are appended to queue in level order and get their level, returns their count.
+static int bfs_levels(CSR g, int s, int t, int depth, int *level, int *queue) {
+    int n = 0;
+    if (depth < 1)
+        return 0;
+    for (int u = s; u < t; u++) {
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            int v = g.col_idx[i];
+            if ((v < s || v >= t) && level[v] < 0) {
+                level[v] = 1;
+                queue[n++] = v;
+            }
+        }
+    }
+
+    for (int head = 0; head < n && level[queue[head]] < depth; head++) {
+        int u = queue[head];
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            int v = g.col_idx[i];
+            if ((v < s || v >= t) && level[v] < 0) {
+                level[v] = level[u] + 1;
+                queue[n++] = v;
+            }
+        }
+    }
+
+    return n;
+}
+
+// Items within depth hops of another part are sent to it, depth > 1 is used by matrix powers
+void find_sendlists(CSR g, int *p, int rank, int size, comm_lists c, int depth) {
     int *send_mark = malloc(sizeof(int) * g.num_rows);
+    int *level = malloc(sizeof(int) * g.num_rows);
+    int *queue = malloc(sizeof(int) * g.num_rows);
+    for (int i = 0; i < g.num_rows; i++)
+        level[i] = -1;
+
     for (int r = 0; r < size; r++) {
         c.send_count[r] = 0;
         c.send_items[r] = NULL;
@@ -267,12 +1045,12 @@ void find_sendlists(CSR g, int *p, int rank, int size, comm_lists c) {
             send_mark[i] = 0;
 
         // Find separators
-        for (int u = p[r]; u < p[r + 1]; u++) {
-            for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
-                int v = g.col_idx[i];
-                if (v >= p[rank] && v < p[rank + 1])
-                    send_mark[v] = 1;
-            }
+        int n = bfs_levels(g, p[r], p[r + 1], depth, level, queue);
+        for (int i = 0; i < n; i++) {
+            int v = queue[i];
+            if (v >= p[rank] && v < p[rank + 1])
+                send_mark[v] = 1;
+            level[v] = -1;
         }
 
         // Count separators
@@ -295,10 +1073,22 @@ void find_sendlists(CSR g, int *p, int rank, int size, comm_lists c) {
     }
 
     free(send_mark);
+    free(level);
+    free(queue);
 }
 
-void find_receivelists(CSR g, int *p, int rank, int size, comm_lists c) {
-    int *receive_mark = malloc(sizeof(int) * g.num_rows);
+void find_receivelists(CSR g, int *p, int rank, int size, comm_lists c, int depth) {
+    int *receive_mark = calloc(g.num_rows, sizeof(int));
+    int *level = malloc(sizeof(int) * g.num_rows);
+    int *queue = malloc(sizeof(int) * g.num_rows);
+    for (int i = 0; i < g.num_rows; i++)
+        level[i] = -1;
+
+    // Find separators
+    int n = bfs_levels(g, p[rank], p[rank + 1], depth, level, queue);
+    for (int i = 0; i < n; i++)
+        receive_mark[queue[i]] = 1;
+
     for (int r = 0; r < size; r++) {
         c.receive_count[r] = 0;
         c.receive_items[r] = NULL;
@@ -306,19 +1096,6 @@ void find_receivelists(CSR g, int *p, int rank, int size, comm_lists c) {
         if (r == rank)
             continue;
 
-        // Set marks to zero
-        for (int i = p[r]; i < p[r + 1]; i++)
-            receive_mark[i] = 0;
-
-        // Find separators
-        for (int u = p[rank]; u < p[rank + 1]; u++) {
-            for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
-                int v = g.col_idx[i];
-                if (v >= p[r] && v < p[r + 1])
-                    receive_mark[v] = 1;
-            }
-        }
-
         // Count separators
         for (int i = p[r]; i < p[r + 1]; i++)
             c.receive_count[r] += receive_mark[i];
@@ -337,6 +1114,53 @@ void find_receivelists(CSR g, int *p, int rank, int size, comm_lists c) {
     }
 
     free(receive_mark);
+    free(level);
+    free(queue);
+}
+
+void spmv_rows(CSR g, int *rows, int n, double *x, double *y) {
+#pragma omp parallel for schedule(static)
+    for (int k = 0; k < n; k++) {
+        int u = rows[k];
+        double z = 0.0;
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            int v = g.col_idx[i];
+            z += x[v] * g.values[i];
+        }
+        y[u] = z;
+    }
+}
+
+// Ghost rows within steps - 1 hops of the rows [s, t), in level order
+powers_plan init_powers_plan(CSR g, int s, int t, int steps) {
+    powers_plan m = {.steps = steps, .ghost_ptr = malloc(sizeof(int) * (steps + 1))};
+    int *level = malloc(sizeof(int) * g.num_rows);
+    int *queue = malloc(sizeof(int) * g.num_rows);
+    for (int i = 0; i < g.num_rows; i++)
+        level[i] = -1;
+
+    int n = bfs_levels(g, s, t, steps - 1, level, queue);
+    m.ghost_rows = malloc(sizeof(int) * (n + 1));
+    memcpy(m.ghost_rows, queue, sizeof(int) * n);
+
+    m.ghost_ptr[0] = 0;
+    for (int l = 1; l <= steps; l++) {
+        m.ghost_ptr[l] = m.ghost_ptr[l - 1];
+        while (m.ghost_ptr[l] < n && level[m.ghost_rows[m.ghost_ptr[l]]] <= l)
+            m.ghost_ptr[l]++;
+    }
+
+    free(level);
+    free(queue);
+    return m;
+}
+
+void free_powers_plan(powers_plan *m) {
+    free(m->ghost_ptr);
+    free(m->ghost_rows);
+    m->ghost_ptr = NULL;
+    m->ghost_rows = NULL;
+    m->steps = 0;
 }
 
 // attempts to make good load balancing without splitting the rows.
@@ -344,7 +1168,7 @@ void partition_graph_naive(CSR g, int s, int t, int k, int *p) {
     int edges_per = (g.row_ptr[t] - g.row_ptr[s]) / k;
     p[0] = s;
     int id = 1;
-    for (int u = s; u < t; u++) {
+    for (int u = s; u < t && id < k; u++) {
         if ((g.row_ptr[u] - g.row_ptr[s]) >= edges_per * id)
             p[id++] = u;
     }
@@ -353,28 +1177,34 @@ void partition_graph_naive(CSR g, int s, int t, int k, int *p) {
     p[k] = t;
 }
 
-void distribute_graph(CSR *g, int rank) {
-    MPI_Bcast(&g->num_rows, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(&g->num_cols, 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-    if (rank != 0) {
-        g->row_ptr = malloc(sizeof(int) * (g->num_rows + 1));
-        g->col_idx = malloc(sizeof(int) * g->num_cols);
-        g->values = malloc(sizeof(double) * g->num_cols);
-    }
-
-    MPI_Bcast(g->row_ptr, g->num_rows + 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(g->col_idx, g->num_cols, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Bcast(g->values, g->num_cols, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+int *find_rank_nodes(MPI_Comm comm) {
+    int rank, size, node_rank;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    MPI_Comm node;
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &node_rank);
+
+    // Nodes are numbered by their first rank, which passes the number on inside its node
+    int *node_of = malloc(sizeof(int) * size);
+    int leader = node_rank == 0, id = 0;
+    MPI_Allgather(&leader, 1, MPI_INT, node_of, 1, MPI_INT, comm);
+    for (int r = 0; r < rank; r++)
+        id += node_of[r];
+    MPI_Bcast(&id, 1, MPI_INT, 0, node);
+    MPI_Allgather(&id, 1, MPI_INT, node_of, 1, MPI_INT, comm);
+
+    MPI_Comm_free(&node);
+    return node_of;
 }
 
 comm_lists init_comm_lists(int size) {
     comm_lists c = {.send_count = malloc(sizeof(int) * size),
                     .receive_count = malloc(sizeof(int) * size),
-                    .send_items = malloc(sizeof(int *) * size),
-                    .receive_items = malloc(sizeof(int *) * size),
-                    .send_lists = malloc(sizeof(double *) * size),
-                    .receive_lists = malloc(sizeof(double *) * size)};
+                    .send_items = calloc(size, sizeof(int *)),
+                    .receive_items = calloc(size, sizeof(int *)),
+                    .send_lists = calloc(size, sizeof(double *)),
+                    .receive_lists = calloc(size, sizeof(double *))};
     return c;
 }
 
@@ -396,28 +1226,33 @@ void free_comm_lists(comm_lists *c, int size) {
     free(c->receive_lists);
 }
 
-void exchange_separators(comm_lists c, double *y, int *displs, int rank, int size) {
-    MPI_Request *requests = malloc(sizeof(MPI_Request) * 2 * size);
-    int req_count = 0;
+halo_request exchange_separators_begin(comm_lists c, double *y, int *displs, int rank, int size, int k) {
+    halo_request h = {.requests = malloc(sizeof(MPI_Request) * 2 * size)};
 
     for (int r = 0; r < size; r++) {
         if (rank == r || c.send_items[r][rank] == 0) // If r doesn't send to me
             continue;
-        MPI_Irecv(y + displs[r], c.send_count[r], MPI_DOUBLE, r, 0, MPI_COMM_WORLD, &requests[req_count++]);
+        MPI_Irecv(y + (size_t)displs[r] * k, c.send_count[r] * k, MPI_DOUBLE, r, 0, MPI_COMM_WORLD,
+                  &h.requests[h.num_requests++]);
     }
 
     for (int r = 0; r < size; r++) {
         if (rank == r || c.send_items[rank][r] == 0) // If I don't send to r
             continue;
-        MPI_Isend(y + displs[rank], c.send_count[rank], MPI_DOUBLE, r, 0, MPI_COMM_WORLD, &requests[req_count++]);
+        MPI_Isend(y + (size_t)displs[rank] * k, c.send_count[rank] * k, MPI_DOUBLE, r, 0, MPI_COMM_WORLD,
+                  &h.requests[h.num_requests++]);
     }
 
-    // Wait for all communication to complete
-    MPI_Waitall(req_count, requests, MPI_STATUSES_IGNORE);
-    free(requests);
+    return h;
 }
 
-void exchange_required_separators(comm_lists c, double *Vn, int rank, int size) {
+void exchange_separators(comm_lists c, double *y, int *displs, int rank, int size, int k) {
+    halo_request h = exchange_separators_begin(c, y, displs, rank, size, k);
+    exchange_end(&h);
+}
+
+halo_request exchange_required_separators_begin(comm_lists c, double *Vn, int rank, int size, int k) {
+    halo_request h = {.requests = malloc(sizeof(MPI_Request)), .c = c, .y = Vn, .size = size, .k = k};
     int total_send = 0, total_recv = 0;
 
     // Compute total send and receive counts
@@ -426,46 +1261,84 @@ void exchange_required_separators(comm_lists c, double *Vn, int rank, int size)
         total_recv += c.receive_count[i];
     }
 
-    // Allocate send and receive buffers
-    double *send_buffer = malloc(sizeof(double) * total_send);
-    double *recv_buffer = malloc(sizeof(double) * total_recv);
+    // Allocate send and receive buffers, k values per separator
+    h.send_buffer = malloc(sizeof(double) * total_send * k);
+    h.recv_buffer = malloc(sizeof(double) * total_recv * k);
 
     // Pack send buffer
     int send_offset = 0;
     for (int i = 0; i < size; i++) {
         for (int j = 0; j < c.send_count[i]; j++) {
-            send_buffer[send_offset++] = Vn[c.send_items[i][j]];
+            for (int l = 0; l < k; l++)
+                h.send_buffer[send_offset++] = Vn[(size_t)c.send_items[i][j] * k + l];
         }
     }
 
-    // Compute displacement arrays for MPI_Ialltoallv
-    int *sdispls = malloc(sizeof(int) * size);
-    int *rdispls = malloc(sizeof(int) * size);
+    // Compute count and displacement arrays for MPI_Ialltoallv, they must live until completion
+    h.counts = malloc(sizeof(int) * 4 * size);
+    int *scounts = h.counts, *rcounts = h.counts + size;
+    int *sdispls = h.counts + 2 * size, *rdispls = h.counts + 3 * size;
     sdispls[0] = 0;
     rdispls[0] = 0;
 
+    for (int i = 0; i < size; i++) {
+        scounts[i] = c.send_count[i] * k;
+        rcounts[i] = c.receive_count[i] * k;
+    }
+
     for (int i = 1; i < size; i++) {
-        sdispls[i] = sdispls[i - 1] + c.send_count[i - 1];
-        rdispls[i] = rdispls[i - 1] + c.receive_count[i - 1];
+        sdispls[i] = sdispls[i - 1] + scounts[i - 1];
+        rdispls[i] = rdispls[i - 1] + rcounts[i - 1];
     }
 
-    MPI_Request *reqs = malloc(sizeof(MPI_Request) * size);
-    int num_reqs = 0;
-    MPI_Ialltoallv(send_buffer, c.send_count, sdispls, MPI_DOUBLE, recv_buffer, c.receive_count, rdispls, MPI_DOUBLE,
-                   MPI_COMM_WORLD, &reqs[num_reqs++]);
+    MPI_Ialltoallv(h.send_buffer, scounts, sdispls, MPI_DOUBLE, h.recv_buffer, rcounts, rdispls, MPI_DOUBLE,
+                   MPI_COMM_WORLD, &h.requests[h.num_requests++]);
 
-    MPI_Waitall(num_reqs, reqs, MPI_STATUSES_IGNORE);
+    return h;
+}
 
-    // Unpack received values into Vn
-    int recv_offset = 0;
-    for (int i = 0; i < size; i++) {
-        for (int j = 0; j < c.receive_count[i]; j++) {
-            Vn[c.receive_items[i][j]] = recv_buffer[recv_offset++];
+void exchange_required_separators(comm_lists c, double *Vn, int rank, int size, int k) {
+    halo_request h = exchange_required_separators_begin(c, Vn, rank, size, k);
+    exchange_end(&h);
+}
+
+void exchange_end(halo_request *h) {
+    MPI_Waitall(h->num_requests, h->requests, MPI_STATUSES_IGNORE);
+
+    // Unpack received values into y
+    if (h->recv_buffer != NULL) {
+        int recv_offset = 0;
+        for (int i = 0; i < h->size; i++) {
+            for (int j = 0; j < h->c.receive_count[i]; j++) {
+                for (int l = 0; l < h->k; l++)
+                    h->y[(size_t)h->c.receive_items[i][j] * h->k + l] = h->recv_buffer[recv_offset++];
+            }
         }
     }
 
-    free(send_buffer);
-    free(recv_buffer);
-    free(sdispls);
-    free(rdispls);
+    free(h->requests);
+    free(h->send_buffer);
+    free(h->recv_buffer);
+    free(h->counts);
+    h->requests = NULL;
+    h->send_buffer = NULL;
+    h->recv_buffer = NULL;
+    h->counts = NULL;
+    h->num_requests = 0;
+}
+
+// Rows [s, split) hold every row with a column outside [s, t), so rows [split, t) can be
+// computed before the halo arrives. The separator-first orderings make the split tight.
+int interior_split(CSR g, int s, int t) {
+    int split = s;
+#pragma omp parallel for schedule(static) reduction(max : split)
+    for (int u = s; u < t; u++) {
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            if (g.col_idx[i] < s || g.col_idx[i] >= t) {
+                split = u + 1 > split ? u + 1 : split;
+                break;
+            }
+        }
+    }
+    return split;
 }
@@ -1,5 +1,7 @@
 #pragma once
 #include "mtx.h"
+#include <mpi.h>
+
 typedef struct {
     int send_count_total, receive_count_total;
     int *send_mark, *receive_mark;
@@ -8,36 +10,110 @@ typedef struct {
     double **send_lists, **receive_lists;
 } comm_lists;
 
+// Secondary order of the rows inside every part, see apply_partition
+typedef enum { ORDER_NONE, ORDER_RCM, ORDER_DEGREE, ORDER_BFS } row_order;
+
+// Vertex weights of the METIS graph: one per row, the row's nonzeros, or its nonzeros and
+// separator rows as two constraints
+typedef enum { WEIGHTS_ROWS, WEIGHTS_NNZ, WEIGHTS_NNZ_SEPARATORS } partition_weights;
+
+// METIS objective: edges cut or total communication volume
+typedef enum { OBJECTIVE_CUT, OBJECTIVE_VOLUME } partition_objective;
+
+typedef struct {
+    row_order order;
+    partition_weights weights;
+    partition_objective objective;
+    int block_size;         // consecutive rows that must stay in the same part, e.g. BCSR blocks
+    const char *cache_path; // matrix file the METIS result is cached next to, NULL disables
+    int *node_of;           // node of every rank from find_rank_nodes, NULL if unknown
+    int hierarchical;       // partitions over the nodes first, then over the ranks of each node
+    int edge_weights;       // METIS edges count how many of a_ij and a_ji are stored, else unit
+} partition_options;
+
 void spmv(CSR g, double *x, double *y, long long int *flops);
 
 void spmv_part(CSR g, int rank, int s, int t, double *x, double *y);
 
-void partition_graph_1b(CSR g, int k, int *p, comm_lists *c);
+void spmm_part(CSR g, int rank, int s, int t, int k, double *X, double *Y);
+
+typedef enum { SCHEDULE_STATIC, SCHEDULE_NNZ, SCHEDULE_MERGE } row_schedule;
+
+// Merge-path decomposition of rows [s, t), thread i starts at (row_start[i], nz_start[i])
+typedef struct {
+    int num_threads;
+    int *row_start, *nz_start;
+    int *carry_row;
+    double *carry_val;
+} merge_schedule;
+
+void spmv_part_balanced(CSR g, int *bounds, int num_threads, double *x, double *y);
+
+merge_schedule init_merge_schedule(CSR g, int s, int t, int num_threads);
+
+void spmv_part_merge(CSR g, merge_schedule m, double *x, double *y);
+
+void free_merge_schedule(merge_schedule *m);
 
-void partition_graph_1c(CSR g, int k, int *p, comm_lists *c);
+void partition_graph_1b(CSR g, int k, int *p, comm_lists *c, partition_options po);
 
-void find_receivelists(CSR g, int *p, int rank, int size, comm_lists c);
+void partition_graph_1c(CSR g, int k, int *p, comm_lists *c, partition_options po);
 
-void find_sendlists(CSR g, int *p, int rank, int size, comm_lists c);
+void find_receivelists(CSR g, int *p, int rank, int size, comm_lists c, int depth);
 
-void partition_graph(CSR g, int num_partitions, int *partition_idx);
+void find_sendlists(CSR g, int *p, int rank, int size, comm_lists c, int depth);
+
+// Communication-avoiding matrix powers: ghost rows of level l are
+// ghost_rows[ghost_ptr[l - 1]..ghost_ptr[l]) and are recomputed while l <= steps - j
+typedef struct {
+    int steps;
+    int *ghost_ptr, *ghost_rows;
+} powers_plan;
+
+void spmv_rows(CSR g, int *rows, int n, double *x, double *y);
+
+powers_plan init_powers_plan(CSR g, int s, int t, int steps);
+
+void free_powers_plan(powers_plan *m);
+
+void partition_graph(CSR g, int num_partitions, int *partition_idx, partition_options po);
 
 void partition_graph_naive(CSR g, int s, int t, int k, int *p);
 
-void distribute_graph(CSR *g, int rank);
+// Node of every rank of comm, nodes are the shared memory domains numbered from 0
+int *find_rank_nodes(MPI_Comm comm);
 
 comm_lists init_comm_lists(int size);
 
 void free_comm_lists(comm_lists *c, int size);
 
-// void find_sendlists(CSR g, int *p, int rank, int size, comm_lists c);
+// void find_sendlists(CSR g, int *p, int rank, int size, comm_lists c, int depth);
 
-// void find_receivelists(CSR g, int *p, int rank, int size, comm_lists c);
+// void find_receivelists(CSR g, int *p, int rank, int size, comm_lists c, int depth);
 
 void reorder_separators(CSR g, int num_partitions, int *partition_idx, double *x, comm_lists *c);
 
-void exchange_separators(comm_lists c, double *y, int *displs, int rank, int size);
+// A halo exchange in flight, started by one of the *_begin calls and completed by exchange_end
+typedef struct {
+    int num_requests;
+    MPI_Request *requests;
+    double *send_buffer, *recv_buffer; // packed exchanges only, received values are unpacked into y
+    int *counts;
+    comm_lists c;
+    double *y;
+    int size, k;
+} halo_request;
+
+void exchange_separators(comm_lists c, double *y, int *displs, int rank, int size, int k);
+
+halo_request exchange_separators_begin(comm_lists c, double *y, int *displs, int rank, int size, int k);
 
 // void exchange_separators(comm_lists c, double *x, double *y, int *displs, int rank, int size);
 
-void exchange_required_separators(comm_lists c, double *y, int rank, int size);
+void exchange_required_separators(comm_lists c, double *y, int rank, int size, int k);
+
+halo_request exchange_required_separators_begin(comm_lists c, double *y, int rank, int size, int k);
+
+void exchange_end(halo_request *h);
+
+int interior_split(CSR g, int s, int t);
@@ -1,100 +1,73 @@
+#include "bench.h"
+#include "local.h"
 #include "mtx.h"
 #include "spmv.h"
-#include <math.h>
 #include <mpi.h>
-#include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 
-int main(int argc, char **argv) {
-    int rank, size;
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
+// Every rank gathers the whole vector after every product
+typedef struct {
+    int *recvcounts, *displs;
+} allgather;
 
+static void setup_allgather(bench_state *b) {
     CSR g;
-    double tcomm, tcomp, t0, t1;
-    int *p = malloc(sizeof(int) * size + 1);
-
-    if (rank == 0) {
-        g = parse_and_validate_mtx(argv[1]);
-        partition_graph(g, size, p);
+    if (b->rank == 0) {
+        g = parse_and_validate_mtx(b->opt.path);
+        tune_kernel(g, &b->opt);
+        partition_graph(g, b->size, b->p, b->opt.part);
     }
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    distribute_graph(&g, rank);
-    MPI_Bcast(p, size + 1, MPI_INT, 0, MPI_COMM_WORLD);
-
-    double *x = (double *)malloc(sizeof(double) * g.num_rows);
-    double *y = (double *)malloc(sizeof(double) * g.num_rows);
-
-    for (int i = 0; i < g.num_rows; i++) {
-        x[i] = 2.0;
-        y[i] = 2.0;
+    distribute_rows(b, g);
+
+    allgather *a = malloc(sizeof(allgather));
+    a->recvcounts = malloc(sizeof(int) * b->size);
+    a->displs = malloc(sizeof(int) * b->size);
+    for (int i = 0; i < b->size; i++) {
+        a->recvcounts[i] = b->p[i + 1] - b->p[i];
+        a->displs[i] = b->p[i];
     }
+    b->impl = a;
+    b->exchange_values = b->g.num_rows;
+}
 
-    MPI_Barrier(MPI_COMM_WORLD);
-    tcomm = 0.0, tcomp = 0.0;
-
-    int *recvcounts = malloc(size * sizeof(int));
-    int sendcount = p[rank + 1] - p[rank];
-    int *displs = malloc(size * sizeof(int));
-
-    for (int i = 0; i < size; i++)
-        recvcounts[i] = p[i + 1] - p[i];
-
-    for (int i = 0; i < size; i++)
-        displs[i] = p[i];
-
-    t0 = MPI_Wtime();
+static void exchange_allgather(bench_state *b) {
+    allgather *a = b->impl;
+    // In place: this rank's rows already sit at displs[rank] in x
+    MPI_Allgatherv(MPI_IN_PLACE, 0, b->row_type, b->x, a->recvcounts, a->displs, b->row_type, MPI_COMM_WORLD);
+}
 
-    for (int i = 0; i < 100; i++) {
-        double tc1 = MPI_Wtime();
-        spmv_part(g, rank, p[rank], p[rank + 1], x, y);
+static void run_allgather(bench_state *b, int iters, phase_times *t) {
+    // The allgather is a blocking collective, its time counts as wait
+    for (int i = 0; i < iters; i++) {
+        stamp tc1 = take_stamp(b);
+        exchange_allgather(b);
+        stamp tc2 = take_stamp(b);
+        spmv_kernel(b->k, b->x, b->y);
+        stamp tc3 = take_stamp(b);
         MPI_Barrier(MPI_COMM_WORLD);
-        double tc2 = MPI_Wtime();
-        MPI_Allgatherv(y + displs[rank], sendcount, MPI_DOUBLE, y, recvcounts, displs, MPI_DOUBLE, MPI_COMM_WORLD);
-        double tc3 = MPI_Wtime();
-        double *tmp = x;
-        x = y;
-        y = tmp;
-        tcomm += tc3 - tc2;
-        tcomp += tc2 - tc1;
+        stamp tc4 = take_stamp(b);
+        double *tmp = b->x;
+        b->x = b->y;
+        b->y = tmp;
+        add_phase(t, PHASE_WAIT, tc1, tc2);
+        add_phase(t, PHASE_SPMV, tc2, tc3);
+        add_phase(t, PHASE_IDLE, tc3, tc4);
     }
-    t1 = MPI_Wtime();
-
-    double l2 = 0.0;
-    if (rank == 0) {
-        for (int j = 0; j < g.num_rows; j++)
-            l2 += x[j] * x[j];
-        l2 = sqrt(l2);
-    }
-
-    long double max_comm_size = ((double)g.num_rows * 100.0 * 64.0) / (1024.0 * 1024.0 * 1024.0);
-    long double min_comm_size = ((double)g.num_rows * 100.0 * 64.0) / (1024.0 * 1024.0 * 1024.0);
-    long double avg_comm_size = ((double)g.num_rows * 100.0 * 64.0) / (1024.0 * 1024.0 * 1024.0);
-
-    double ops = (long long)g.num_cols * 2ll * 100ll;
-
-    double time = t1 - t0;
-    MPI_Barrier(MPI_COMM_WORLD);
-    if (rank == 0) {
-        printf("Total time = %lfs\n", time);
-        printf("Communication time = %lfs\n", tcomm);
-        printf("Computation time = %lfs\n", tcomp);
-        printf("NFLOPS = %f\n", ops);
-        printf("GFLOPS = %lf\n", ops / (time * 1e9));
-        printf("Comm min = %Lf GB\nComm max = %Lf GB\nComm avg = %Lf GB\n", min_comm_size, max_comm_size,
-               avg_comm_size);
-    }
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    free(y);
-    free(x);
-    free(p);
-    free(recvcounts);
-    free(displs);
+}
 
-    MPI_Finalize();
-    return 0;
+static void destroy_allgather(bench_state *b) {
+    allgather *a = b->impl;
+    free(a->recvcounts);
+    free(a->displs);
+    free(a);
 }
+
+const strategy strategy_allgather = {.name = "A",
+                                     .alias = "1a",
+                                     .overlaps = 0,
+                                     .halo = 0,
+                                     .setup = setup_allgather,
+                                     .run = run_allgather,
+                                     .exchange = exchange_allgather,
+                                     .describe = NULL,
+                                     .destroy = destroy_allgather};
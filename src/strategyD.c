@@ -1,129 +1,165 @@
+#include "bench.h"
+#include "halo.h"
+#include "ingest.h"
+#include "local.h"
 #include "mtx.h"
 #include "spmv.h"
-#include <math.h>
 #include <mpi.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-int main(int argc, char **argv) {
-    int rank, size;
-    MPI_Init(&argc, &argv);
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-    MPI_Comm_size(MPI_COMM_WORLD, &size);
+// Rank-local matrices with owned rows followed by ghosts, exchanged with the neighbours only.
+// With s-step the halo is s levels deep, so s products can run between exchanges.
+typedef struct {
+    comm_lists c;
+    local_layout lay;
+    powers_plan plan;
+    halo_exchange halo;
+    double **V; // Krylov vectors of the matrix powers kernel, V[0] and V[1] are x and y
+} halo_strategy;
+
+static void setup_halo(bench_state *b) {
+    int rank = b->rank, size = b->size;
+    halo_strategy *a = malloc(sizeof(halo_strategy));
+    a->c = init_comm_lists(size);
 
     CSR g;
-    int *p = malloc(sizeof(int) * (size + 1));
+    if (b->opt.ingest) {
+        // No rank sees the whole matrix, so the block size is tuned on the rows of rank 0
+        g = ingest_graph(b->opt.path, b->p, rank, size);
+        if (rank == 0)
+            tune_kernel(g, &b->opt);
+    } else {
+        if (rank == 0) {
+            g = parse_and_validate_mtx(b->opt.path);
+            tune_kernel(g, &b->opt);
+            // Overlapping needs the boundary rows first, which the separator ordering gives
+            if (b->opt.overlap)
+                partition_graph_1b(g, size, b->p, &a->c, b->opt.part);
+            else
+                partition_graph(g, size, b->p, b->opt.part);
+        }
 
-    for (int i = 0; i < size + 1; i++) {
-        p[i] = 0;
-    }
-
-    comm_lists c = init_comm_lists(size);
-    double tcomm, tcomp, t0, t1;
-
-    if (rank == 0) {
-        g = parse_and_validate_mtx(argv[1]);
-        partition_graph(g, size, p);
-    }
-
-    MPI_Barrier(MPI_COMM_WORLD);
-    distribute_graph(&g, rank);
-    MPI_Bcast(p, size + 1, MPI_INT, 0, MPI_COMM_WORLD);
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    find_sendlists(g, p, rank, size, c);
-    find_receivelists(g, p, rank, size, c);
-
-    double *x = malloc(sizeof(double) * g.num_rows);
-    double *y = malloc(sizeof(double) * g.num_rows);
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    double ts0 = MPI_Wtime();
-
-    for (int i = 0; i < g.num_rows; i++) {
-        x[i] = 2.0;
-        y[i] = 2.0;
-    }
-
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    int *recvcounts = malloc(size * sizeof(int));
-    int *displs = malloc(size * sizeof(int));
-
-    for (int i = 0; i < size; i++) {
-        recvcounts[i] = p[i + 1] - p[i];
-        displs[i] = p[i];
-    }
-
-    MPI_Barrier(MPI_COMM_WORLD);
-
-    t0 = MPI_Wtime();
-    for (int i = 0; i < 100; i++) {
         MPI_Barrier(MPI_COMM_WORLD);
-        double tc1 = MPI_Wtime();
-        exchange_required_separators(c, y, rank, size);
-        double tc2 = MPI_Wtime();
-        double *tmp = y;
-        y = x;
-        x = tmp;
-        spmv_part(g, rank, p[rank], p[rank + 1], x, y);
-        double tc3 = MPI_Wtime();
-        tcomm += tc2 - tc1;
-        tcomp += tc3 - tc2;
-    }
-    t1 = MPI_Wtime();
-
-    MPI_Allgatherv(y + displs[rank], recvcounts[rank], MPI_DOUBLE, y, recvcounts, displs, MPI_DOUBLE, MPI_COMM_WORLD);
-    double *tmp = x;
-    x = y;
-    y = tmp;
+        MPI_Bcast(b->p, size + 1, MPI_INT, 0, MPI_COMM_WORLD);
 
-    long double comm_size = 0.0;
-
-    for (int i = 0; i < size; i++) {
-        comm_size += c.send_count[i];
+        // Each rank keeps its own rows only, x and y hold the owned entries followed by the ghosts
+        CSR own = scatter_graph(g, b->p, rank, size);
+        if (rank == 0)
+            free_graph(&g);
+        g = own;
     }
 
-    long double total_comm_size = 0.0;
-    MPI_Allreduce(&comm_size, &total_comm_size, 1, MPI_LONG_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-
-    comm_size = (comm_size * 64.0 * 100.0) / (1024.0 * 1024.0 * 1024.0);
-
-    long double max_comm_size = 0.0;
-    long double min_comm_size = 0.0;
-    long double avg_comm_size = 0.0;
+    a->lay = localize_graph(&g, b->p, rank, size, b->opt.steps, a->c);
+    a->plan = init_powers_plan(g, 0, a->lay.num_owned, b->opt.steps);
+    a->halo = init_halo_exchange(a->c, rank, size, b->opt.num_vectors);
+
+    b->g = g;
+    b->nnz = a->lay.global_nnz;
+    b->n = a->lay.num_owned + a->lay.num_ghosts;
+    b->s = 0;
+    b->t = a->lay.num_owned;
+    b->steps = b->opt.steps;
+    b->exchange_values = 0.0;
+    for (int i = 0; i < size; i++)
+        b->exchange_values += a->c.send_count[i];
+
+    a->V = malloc(sizeof(double *) * (b->opt.steps + 1));
+    for (int j = 2; j <= b->opt.steps; j++)
+        a->V[j] = malloc(sizeof(double) * b->n);
+    b->impl = a;
+}
 
-    MPI_Reduce(&comm_size, &max_comm_size, 1, MPI_LONG_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
-    MPI_Reduce(&comm_size, &min_comm_size, 1, MPI_LONG_DOUBLE, MPI_MIN, 0, MPI_COMM_WORLD);
-    MPI_Reduce(&comm_size, &avg_comm_size, 1, MPI_LONG_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
-    avg_comm_size /= size;
+static void exchange_halo(bench_state *b) {
+    halo_strategy *a = b->impl;
+    halo_exchange_run(&a->halo, b->x);
+}
 
-    double ops = (long long)g.num_cols * 2ll * 100ll;
-    double time = t1 - t0;
-    double l2 = 0.0;
+// A barrier, then an exchange of x with every step timed on its own. With --overlap there is
+// no barrier and the interior rows run between post and wait.
+static void timed_exchange(bench_state *b, double *x, kernel *interior, double *y, phase_times *t) {
+    halo_exchange *h = &((halo_strategy *)b->impl)->halo;
+    stamp tc0 = take_stamp(b);
+    if (interior == NULL)
+        MPI_Barrier(MPI_COMM_WORLD);
+    stamp tc1 = take_stamp(b);
+    halo_exchange_pack(h, x);
+    stamp tc2 = take_stamp(b);
+    halo_exchange_post(h);
+    stamp tc3 = take_stamp(b);
+    if (interior != NULL)
+        spmv_kernel(*interior, x, y);
+    stamp tc4 = take_stamp(b);
+    halo_exchange_wait(h);
+    stamp tc5 = take_stamp(b);
+    halo_exchange_unpack(h, x);
+    stamp tc6 = take_stamp(b);
+    add_phase(t, PHASE_IDLE, tc0, tc1);
+    add_phase(t, PHASE_PACK, tc1, tc2);
+    add_phase(t, PHASE_POST, tc2, tc3);
+    add_phase(t, PHASE_SPMV, tc3, tc4);
+    add_phase(t, PHASE_WAIT, tc4, tc5);
+    add_phase(t, PHASE_UNPACK, tc5, tc6);
+}
 
-    if (rank == 0) {
-        for (int j = 0; j < g.num_rows; j++)
-            l2 += x[j] * x[j];
-        l2 = sqrt(l2);
+static void run_halo(bench_state *b, int iters, phase_times *t) {
+    halo_strategy *a = b->impl;
+    if (b->steps > 1) {
+        double **V = a->V;
+        V[0] = b->x;
+        V[1] = b->y;
+        // The last round is shorter when iters is not a multiple of s
+        for (int i = 0; i < iters; i += b->steps) {
+            int steps = iters - i < b->steps ? iters - i : b->steps;
+            timed_exchange(b, V[0], NULL, NULL, t);
+            stamp tc1 = take_stamp(b);
+            matrix_powers(b->k, a->plan, steps, V);
+            double *tmp = V[0];
+            V[0] = V[steps];
+            V[steps] = tmp;
+            add_phase(t, PHASE_SPMV, tc1, take_stamp(b));
+        }
+        b->x = V[0];
+        b->y = V[1];
+        return;
     }
 
-    if (rank == 0) {
-        printf("Total time = %lfs\n", time);
-        printf("Communication time = %lfs\n", tcomm);
-        printf("Computation time = %lfs\n", tcomp);
-        printf("GFLOPS = %lf\n", ops / (time * 1e9));
-        printf("NFLOPS = %lf\n", ops);
-        printf("Comm min = %Lf GB\nComm max = %Lf GB\nComm avg = %Lf GB\n", min_comm_size, max_comm_size,
-               avg_comm_size);
+    for (int i = 0; i < iters; i++) {
+        timed_exchange(b, b->x, b->opt.overlap ? &b->k : NULL, b->y, t);
+        stamp tc1 = take_stamp(b);
+        spmv_kernel(b->opt.overlap ? b->kb : b->k, b->x, b->y);
+        add_phase(t, PHASE_SPMV, tc1, take_stamp(b));
+        double *tmp = b->x;
+        b->x = b->y;
+        b->y = tmp;
     }
+}
 
-    free(y);
-    free(x);
-    free(p);
-    free(recvcounts);
-    free(displs);
+static void describe_halo(bench_state *b) {
+    halo_strategy *a = b->impl;
+    if (b->steps > 1)
+        printf("Matrix powers s = %d, exchanges = %d, ghost rows on rank 0 = %d\n", b->steps,
+               (b->opt.iters + b->steps - 1) / b->steps, a->plan.ghost_ptr[b->steps - 1]);
+}
 
-    MPI_Finalize();
-    return 0;
+static void destroy_halo(bench_state *b) {
+    halo_strategy *a = b->impl;
+    for (int j = 2; j <= b->steps; j++)
+        free(a->V[j]);
+    free(a->V);
+    free_halo_exchange(&a->halo);
+    free_powers_plan(&a->plan);
+    free_comm_lists(&a->c, b->size);
+    free_local_layout(&a->lay);
+    free(a);
 }
+
+const strategy strategy_halo = {.name = "D",
+                                .alias = "1d",
+                                .overlaps = 1,
+                                .halo = 1,
+                                .setup = setup_halo,
+                                .run = run_halo,
+                                .exchange = exchange_halo,
+                                .describe = describe_halo,
+                                .destroy = destroy_halo};
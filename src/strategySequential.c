@@ -1,44 +1,39 @@
+#include "bench.h"
 #include "mtx.h"
-#include "spmv.h"
-#include <math.h>
+#include <mpi.h>
 #include <stdlib.h>
-#include <time.h>
-int main(int argc, char **argv) {
-    CSR g;
-    clock_t start, end;
-    g = parse_and_validate_mtx(argv[1]);
 
-    double *x = malloc(sizeof(double) * g.num_rows);
-    double *y = malloc(sizeof(double) * g.num_rows);
-
-    for (int i = 0; i < g.num_rows; i++) {
-        x[i] = 2.0;
-        y[i] = 2.0;
-    }
-    long long int flops = 0;
+// The whole matrix on a single rank, the reference every distributed strategy is checked against
+static void setup_sequential(bench_state *b) {
+    b->g = parse_and_validate_mtx(b->opt.path);
+    tune_kernel(b->g, &b->opt);
+    b->p[0] = 0;
+    b->p[1] = b->g.num_rows;
+    b->nnz = b->g.num_cols;
+    b->n = b->g.num_rows;
+    b->s = 0;
+    b->t = b->g.num_rows;
+}
 
-    start = clock();
-    for (int i = 0; i < 100; i++) {
-        spmv(g, x, y, &flops);
-        double *tmp = x;
-        x = y;
-        y = tmp;
+static void run_sequential(bench_state *b, int iters, phase_times *t) {
+    for (int i = 0; i < iters; i++) {
+        stamp tc1 = take_stamp(b);
+        spmv_kernel(b->k, b->x, b->y);
+        double *tmp = b->x;
+        b->x = b->y;
+        b->y = tmp;
+        add_phase(t, PHASE_SPMV, tc1, take_stamp(b));
     }
-    end = clock();
-    double ops = (long long)g.num_cols * 2ll * 100ll;
-
-    double l2 = 0.0;
-    for (int i = 0; i < g.num_rows; i++)
-        l2 += x[i] * x[i];
-    l2 = sqrt(l2);
-
-    double time = (double)(end - start) / CLOCKS_PER_SEC;
+}
 
-    printf("L2 norm: %f\n", l2);
-    printf("Time: %f\n", (double)(end - start) / CLOCKS_PER_SEC);
-    printf("GFLOPS: %f\n", (ops / (time * 1e9)));
+static void destroy_sequential(bench_state *b) {}
 
-    free(x);
-    free(y);
-    return 0;
-}
+const strategy strategy_sequential = {.name = "seq",
+                                      .alias = "sequential",
+                                      .overlaps = 0,
+                                      .halo = 0,
+                                      .setup = setup_sequential,
+                                      .run = run_sequential,
+                                      .exchange = NULL,
+                                      .describe = NULL,
+                                      .destroy = destroy_sequential};
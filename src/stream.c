@@ -0,0 +1,47 @@
+#include "stream.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+double stream_triad(MPI_Comm comm, size_t n, int reps) {
+    const double scalar = 3.0;
+    double *a = malloc(sizeof(double) * (n + 1));
+    double *b = malloc(sizeof(double) * (n + 1));
+    double *c = malloc(sizeof(double) * (n + 1));
+
+    // First touch by the threads that run the triad places the pages on their NUMA node
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; i++) {
+        a[i] = 1.0;
+        b[i] = 2.0;
+        c[i] = 0.5;
+    }
+
+    double best = INFINITY;
+    for (int r = 0; r < reps; r++) {
+        MPI_Barrier(comm);
+        double t0 = MPI_Wtime();
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; i++)
+            a[i] = b[i] + scalar * c[i];
+        double t = MPI_Wtime() - t0;
+        MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, comm);
+        if ((r > 0 || reps == 1) && t < best)
+            best = t;
+    }
+
+    // Checking the result also keeps the compiler from dropping the triad
+    size_t wrong = 0;
+    for (size_t i = 0; i < n; i++)
+        wrong += a[i] != 2.0 + scalar * 0.5;
+    if (wrong > 0)
+        fprintf(stderr, "STREAM triad: %zu wrong entries\n", wrong);
+
+    double bytes = 3.0 * sizeof(double) * n;
+    MPI_Allreduce(MPI_IN_PLACE, &bytes, 1, MPI_DOUBLE, MPI_SUM, comm);
+
+    free(a);
+    free(b);
+    free(c);
+    return best > 0.0 && isfinite(best) ? bytes / best : 0.0;
+}
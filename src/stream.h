@@ -0,0 +1,9 @@
+#pragma once
+#include <mpi.h>
+#include <stddef.h>
+
+// STREAM triad a = b + s * c on n doubles per rank, run by every rank of comm at once with its
+// OpenMP threads, so it sees the same contention as the benchmark. Returns the aggregate
+// bandwidth in bytes/s of the best of reps rounds, the first excluded, counting 3 * 8 bytes
+// per element like STREAM does.
+double stream_triad(MPI_Comm comm, size_t n, int reps);
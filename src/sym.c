@@ -0,0 +1,202 @@
+#include "sym.h"
+#include "spmv.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int row, col;
+    double v;
+} sym_entry;
+
+static int compare_sym_entry(const void *a, const void *b) {
+    const sym_entry *ea = a, *eb = b;
+    if (ea->row != eb->row)
+        return ea->row - eb->row;
+    return ea->col - eb->col;
+}
+
+// Compares the strict upper triangle of the diagonal block with the transposed lower one
+int is_symmetric(CSR g, int s, int t) {
+    int n_upper = 0, n_lower = 0;
+#pragma omp parallel for schedule(static) reduction(+ : n_upper, n_lower)
+    for (int u = s; u < t; u++) {
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            int v = g.col_idx[i];
+            if (v >= s && v < t && v > u)
+                n_upper++;
+            if (v >= s && v < t && v < u)
+                n_lower++;
+        }
+    }
+    if (n_upper != n_lower)
+        return 0;
+
+    sym_entry *upper = malloc(sizeof(sym_entry) * (n_upper + 1));
+    sym_entry *lower = malloc(sizeof(sym_entry) * (n_lower + 1));
+    int ku = 0, kl = 0;
+    for (int u = s; u < t; u++) {
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            int v = g.col_idx[i];
+            if (v >= s && v < t && v > u)
+                upper[ku++] = (sym_entry){u, v, g.values[i]};
+            if (v >= s && v < t && v < u)
+                lower[kl++] = (sym_entry){v, u, g.values[i]};
+        }
+    }
+
+    qsort(upper, n_upper, sizeof(sym_entry), compare_sym_entry);
+    qsort(lower, n_lower, sizeof(sym_entry), compare_sym_entry);
+
+    int symmetric = 1;
+    for (int i = 0; i < n_upper && symmetric; i++)
+        if (upper[i].row != lower[i].row || upper[i].col != lower[i].col || upper[i].v != lower[i].v)
+            symmetric = 0;
+
+    free(upper);
+    free(lower);
+    return symmetric;
+}
+
+CSR_sym build_sym(CSR g, int s, int t, int num_threads) {
+    CSR_sym m;
+    m.num_rows = t - s;
+    m.num_threads = num_threads;
+    m.row_ptr = malloc(sizeof(int) * (m.num_rows + 1));
+    m.halo_ptr = malloc(sizeof(int) * (m.num_rows + 1));
+    m.row_ptr[0] = 0;
+    m.halo_ptr[0] = 0;
+
+#pragma omp parallel for schedule(static)
+    for (int u = s; u < t; u++) {
+        int upper = 0, halo = 0;
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            int v = g.col_idx[i];
+            if (v < s || v >= t)
+                halo++;
+            else if (v >= u)
+                upper++;
+        }
+        m.row_ptr[u - s + 1] = upper;
+        m.halo_ptr[u - s + 1] = halo;
+    }
+
+    for (int u = 0; u < m.num_rows; u++) {
+        m.row_ptr[u + 1] += m.row_ptr[u];
+        m.halo_ptr[u + 1] += m.halo_ptr[u];
+    }
+
+    m.col_idx = malloc(sizeof(int) * (m.row_ptr[m.num_rows] + 1));
+    m.values = malloc(sizeof(double) * (m.row_ptr[m.num_rows] + 1));
+    m.halo_idx = malloc(sizeof(int) * (m.halo_ptr[m.num_rows] + 1));
+    m.halo_values = malloc(sizeof(double) * (m.halo_ptr[m.num_rows] + 1));
+
+#pragma omp parallel for schedule(static)
+    for (int u = s; u < t; u++) {
+        int j = m.row_ptr[u - s], k = m.halo_ptr[u - s];
+        for (int i = g.row_ptr[u]; i < g.row_ptr[u + 1]; i++) {
+            int v = g.col_idx[i];
+            if (v < s || v >= t) {
+                m.halo_idx[k] = v;
+                m.halo_values[k++] = g.values[i];
+            } else if (v >= u) {
+                m.col_idx[j] = v - s;
+                m.values[j++] = g.values[i];
+            }
+        }
+    }
+
+    // Balance threads on the stored entries, both triangles are touched once per entry
+    int *work = malloc(sizeof(int) * (m.num_rows + 1));
+    for (int u = 0; u <= m.num_rows; u++)
+        work[u] = m.row_ptr[u] + m.halo_ptr[u];
+    CSR w = {.num_rows = m.num_rows, .row_ptr = work};
+    m.bounds = malloc(sizeof(int) * (num_threads + 1));
+    partition_graph_naive(w, 0, m.num_rows, num_threads, m.bounds);
+    free(work);
+
+    m.reach = malloc(sizeof(int) * num_threads);
+    m.buffer = malloc(sizeof(double *) * num_threads);
+    for (int tid = 0; tid < num_threads; tid++) {
+        int reach = m.bounds[tid + 1];
+        for (int i = m.row_ptr[m.bounds[tid]]; i < m.row_ptr[m.bounds[tid + 1]]; i++)
+            if (m.col_idx[i] + 1 > reach)
+                reach = m.col_idx[i] + 1;
+        m.reach[tid] = reach;
+        m.buffer[tid] = malloc(sizeof(double) * (reach - m.bounds[tid] + 1));
+    }
+
+    m.candidate_ptr = malloc(sizeof(int) * (num_threads + 1));
+    m.candidates = malloc(sizeof(int) * (num_threads * num_threads + 1));
+    m.candidate_ptr[0] = 0;
+    for (int o = 0; o < num_threads; o++) {
+        int k = m.candidate_ptr[o];
+        for (int tid = 0; tid < o; tid++)
+            if (m.reach[tid] > m.bounds[o])
+                m.candidates[k++] = tid;
+        m.candidate_ptr[o + 1] = k;
+    }
+
+    return m;
+}
+
+void spmv_sym(CSR_sym m, int s, double *x, double *y) {
+    // Every thread scatters the transposed products into its own buffer, so no atomics
+#pragma omp parallel for schedule(static, 1)
+    for (int tid = 0; tid < m.num_threads; tid++) {
+        int a = m.bounds[tid];
+        double *w = m.buffer[tid];
+        memset(w, 0, sizeof(double) * (m.reach[tid] - a));
+
+        for (int u = a; u < m.bounds[tid + 1]; u++) {
+            double z = 0.0, xu = x[s + u];
+            for (int i = m.halo_ptr[u]; i < m.halo_ptr[u + 1]; i++)
+                z += m.halo_values[i] * x[m.halo_idx[i]];
+            for (int i = m.row_ptr[u]; i < m.row_ptr[u + 1]; i++) {
+                int v = m.col_idx[i];
+                z += m.values[i] * x[s + v];
+                if (v != u)
+                    w[v - a] += m.values[i] * xu;
+            }
+            w[u - a] += z;
+        }
+    }
+
+    // Each row is then summed over the owner and the lower threads whose buffers reach it
+#pragma omp parallel for schedule(static, 1)
+    for (int o = 0; o < m.num_threads; o++) {
+        for (int u = m.bounds[o]; u < m.bounds[o + 1]; u++) {
+            double z = m.buffer[o][u - m.bounds[o]];
+            for (int k = m.candidate_ptr[o]; k < m.candidate_ptr[o + 1]; k++) {
+                int tid = m.candidates[k];
+                if (u < m.reach[tid])
+                    z += m.buffer[tid][u - m.bounds[tid]];
+            }
+            y[s + u] = z;
+        }
+    }
+}
+
+void free_sym(CSR_sym *m) {
+    for (int tid = 0; tid < m->num_threads; tid++)
+        free(m->buffer[tid]);
+    free(m->buffer);
+    free(m->row_ptr);
+    free(m->col_idx);
+    free(m->values);
+    free(m->halo_ptr);
+    free(m->halo_idx);
+    free(m->halo_values);
+    free(m->bounds);
+    free(m->reach);
+    free(m->candidate_ptr);
+    free(m->candidates);
+    m->buffer = NULL;
+    m->row_ptr = NULL;
+    m->col_idx = NULL;
+    m->values = NULL;
+    m->halo_ptr = NULL;
+    m->halo_idx = NULL;
+    m->halo_values = NULL;
+    m->num_rows = 0;
+    m->num_threads = 0;
+}
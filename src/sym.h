@@ -0,0 +1,29 @@
+#pragma once
+#include "mtx.h"
+
+// Rows [s, t) of a symmetric matrix. Inside the diagonal block only the upper triangle is
+// kept (local indices), entries in columns owned by other ranks are kept as full rows
+// (global indices), so the usual halo exchange of x is all a distributed product needs.
+// The driver frees the CSR entries once the copy is built, unless --overlap or --sstep still
+// read them. The per-thread buffers below span up to the highest column a thread touches, so
+// they approach n on wide-band matrices.
+typedef struct {
+    int num_rows, num_threads;
+    int *row_ptr, *col_idx;
+    double *values;
+    int *halo_ptr, *halo_idx;
+    double *halo_values;
+    // Thread i owns rows [bounds[i], bounds[i + 1]) and scatters into buffer[i], which
+    // covers [bounds[i], reach[i]). candidates lists the lower threads that reach into i.
+    int *bounds, *reach;
+    int *candidate_ptr, *candidates;
+    double **buffer;
+} CSR_sym;
+
+int is_symmetric(CSR g, int s, int t);
+
+CSR_sym build_sym(CSR g, int s, int t, int num_threads);
+
+void spmv_sym(CSR_sym m, int s, double *x, double *y);
+
+void free_sym(CSR_sym *m);